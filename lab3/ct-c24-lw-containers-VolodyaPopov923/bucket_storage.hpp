@@ -1,788 +1,2697 @@
-#ifndef BUCKET_STORAGE
-#define BUCKET_STORAGE
-
-#include <expected>
-#include <iostream>
-#include <iterator>
-
-template< typename T >
-class iterator;
-
-template< typename T >
-class const_iterator;
-
-template< typename T >
-class BucketStorage
-{
-  public:
-	using value_type = T;
-	using pointer = T *;
-	using reference = T &;
-	using const_reference = const T &;
-	using difference_type = long;
-	using size_type = size_t;
-	using iterator = iterator< T >;
-	using const_iterator = const_iterator< T >;
-	friend iterator;
-	friend const_iterator;
-
-  public:
-	BucketStorage(BucketStorage const &other);
-	BucketStorage(BucketStorage &&other) noexcept;
-	explicit BucketStorage(size_t block_capacity = 64);
-
-	iterator insert(const T &value);
-	iterator insert(T &&value);
-
-	iterator erase(const_iterator it) noexcept;
-
-	bool empty() const noexcept;
-
-	size_t size() const noexcept;
-	size_t capacity() const noexcept;
-	void shrink_to_fit();
-	void clear();
-	void swap(BucketStorage &other) noexcept;
-	iterator begin() noexcept;
-	const_iterator begin() const noexcept;
-	const_iterator cbegin() const noexcept;
-	iterator end() noexcept;
-	const_iterator end() const noexcept;
-	const_iterator cend() const noexcept;
-
-	iterator get_to_distance(iterator it, difference_type distance);
-
-	BucketStorage< T > &operator=(const BucketStorage< T > &other);
-	BucketStorage< T > &operator=(BucketStorage< T > &&other) noexcept;
-	~BucketStorage();
-
-  private:
-	class Block
-	{
-	  public:
-		explicit Block(size_t capacity = 64, Block *bwd = nullptr, size_t block_num = 0);
-		Block(const Block &other);
-		~Block();
-		const size_t block_number;
-		const size_t capacity;
-		Block *bwd;
-		Block *fwd;
-		size_t size;
-		size_t *deleted;
-		size_t deleted_count;
-		size_t *activity;
-		T *data;
-		iterator insert();
-		size_t erase(size_t i);
-		size_t head;
-		size_t tail;
-		size_t next(size_t current) const;
-		size_t previous(size_t current) const;
-		bool isActive(size_t i);
-	};
-	Block *head;
-	Block *tail;
-	size_type n;
-	size_type elements;
-	size_type block_capacity;
-};
-
-template< typename T >
-class iterator
-{
-  public:
-	using iterator_category = std::bidirectional_iterator_tag;
-	using value_type = T;
-	using pointer_type = T *;
-	using reference_type = T &;
-	using difference_type = long;
-	friend class const_iterator< T >;
-	friend class BucketStorage< T >;
-
-	iterator< T >(size_t i, typename BucketStorage< T >::Block *current);
-	explicit iterator< T >(const const_iterator< T > &other);
-
-	iterator< T > &operator++();
-	iterator< T > operator++(int);
-	iterator< T > &operator--();
-	iterator< T > operator--(int);
-
-	reference_type operator*();
-	pointer_type operator->() const;
-
-	bool operator==(const iterator< T > &a) const;
-	bool operator==(const const_iterator< T > &a) const;
-	bool operator!=(const iterator< T > &a) const;
-	bool operator<(const iterator< T > &a) const;
-	bool operator<=(const iterator< T > &a) const;
-	bool operator>(const iterator< T > &a) const;
-
-	bool operator>=(const iterator< T > &a) const;
-	iterator< T > &operator=(iterator< T > a);
-
-  private:
-	typename BucketStorage< T >::Block *block;
-	size_t i;
-};
-
-template< typename T >
-class const_iterator
-{
-  public:
-	using iterator_category = std::bidirectional_iterator_tag;
-	using value_type = const T;
-	using pointer_type = const T *;
-	using reference_type = const T &;
-	using difference_type = long;
-	friend class BucketStorage< T >;
-	friend class iterator< T >;
-
-	const_iterator< T >(size_t i, typename BucketStorage< T >::Block *current);
-	const_iterator< T >(const iterator< T > &other);
-
-	const_iterator< T > &operator++();
-	const_iterator< T > operator++(int);
-	const_iterator< T > &operator--();
-	const_iterator< T > operator--(int);
-
-	value_type operator*();
-	reference_type operator->() const;
-
-	bool operator==(const const_iterator< T > &a) const;
-	bool operator!=(const const_iterator< T > &a) const;
-	bool operator<(const const_iterator< T > &a) const;
-	bool operator<=(const const_iterator< T > &a) const;
-	bool operator>(const const_iterator< T > &a) const;
-
-	bool operator>=(const const_iterator< T > &a) const;
-	const_iterator< T > &operator=(const_iterator< T > a);
-
-  private:
-	typename BucketStorage< T >::Block *block;
-	size_t i;
-};
-
-template< typename T >
-BucketStorage< T >::BucketStorage(const BucketStorage &other) :
-	n(other.n), elements(other.elements), block_capacity(other.block_capacity)
-{
-	this->head = new Block(*other.head);
-	Block *current = this->head;
-	while (current->fwd != nullptr)
-		current = current->fwd;
-	this->tail = current;
-}
-template< typename T >
-BucketStorage< T >::BucketStorage(BucketStorage &&other) noexcept :
-	head(other.head), tail(other.tail), n(other.n), elements(other.elements), block_capacity(other.block_capacity)
-{
-	swap(other);
-	other.head = nullptr;
-	other.tail = nullptr;
-}
-template< typename T >
-BucketStorage< T >::BucketStorage(const size_t block_capacity) :
-	elements(0), head(nullptr), tail(nullptr), n(0), block_capacity(block_capacity)
-{
-}
-
-template< typename T >
-typename BucketStorage< T >::iterator BucketStorage< T >::insert(const T &value)
-{
-	if (n == 0)
-	{
-		head = new Block(block_capacity, nullptr, 0);
-		tail = head;
-		n++;
-	}
-	iterator it = head->insert();
-	if (it.block->bwd == tail)
-	{
-		tail = it.block;
-		n++;
-	}
-	it.block->data[it.i] = value;
-	elements++;
-	return it;
-}
-template< typename T >
-typename BucketStorage< T >::iterator BucketStorage< T >::insert(T &&value)
-{
-	if (n == 0)
-	{
-		head = new Block(block_capacity, nullptr, 0);
-		tail = head;
-		n++;
-	}
-	iterator it = head->insert();
-	if (it.block->bwd == tail)
-	{
-		tail = it.block;
-		n++;
-	}
-
-	std::memcpy(it.block->data + it.i, &value, sizeof(T));
-	elements++;
-	return it;
-}
-template< typename T >
-typename BucketStorage< T >::iterator BucketStorage< T >::erase(const_iterator it) noexcept
-{
-	elements--;
-	size_t next_id = it.block->erase(it.i);
-	Block *next_block = it.block;
-	if (it.block->size == 0)
-	{
-		n--;
-		if (n == 0)
-			return iterator(block_capacity, nullptr);
-		if (it.block == tail)
-		{
-			tail = it.block->bwd;
-		}
-		if (it.block == head)
-		{
-			head = it.block->fwd;
-		}
-		next_block = it.block->fwd;
-		if (next_block == nullptr)
-			next_block = it.block->bwd;
-		delete it.block;
-	}
-	if (next_id == 0)
-	{
-		if (next_block->fwd != nullptr)
-			return iterator(next_block->fwd->head, next_block->fwd);
-		return end();
-	}
-	return iterator(next_id, next_block);
-}
-template< typename T >
-void BucketStorage< T >::clear()
-{
-	if (head != nullptr)
-	{
-		while (head->fwd != nullptr)
-			head->fwd->~Block();
-		head->~Block();
-	}
-	head = nullptr;
-	tail = nullptr;
-	elements = 0;
-	n = 0;
-}
-
-template< typename T >
-size_t BucketStorage< T >::capacity() const noexcept
-{
-	return block_capacity * n;
-}
-template< typename T >
-typename BucketStorage< T >::size_type BucketStorage< T >::size() const noexcept
-{
-	return elements;
-}
-template< typename T >
-bool BucketStorage< T >::empty() const noexcept
-{
-	return elements == 0;
-}
-
-template< typename T >
-typename BucketStorage< T >::iterator BucketStorage< T >::end() noexcept
-{
-	return iterator(block_capacity, tail);
-}
-template< typename T >
-typename BucketStorage< T >::const_iterator BucketStorage< T >::end() const noexcept
-{
-	return const_iterator(tail->tail, tail);
-}
-template< typename T >
-typename BucketStorage< T >::const_iterator BucketStorage< T >::cend() const noexcept
-{
-	return const_iterator(tail->tail, tail);
-}
-template< typename T >
-typename BucketStorage< T >::iterator BucketStorage< T >::begin() noexcept
-{
-	if (elements == 0)
-		return end();
-	return iterator(head->head, head);
-}
-template< typename T >
-typename BucketStorage< T >::const_iterator BucketStorage< T >::begin() const noexcept
-{
-	return const_iterator(head->head, head);
-}
-template< typename T >
-typename BucketStorage< T >::const_iterator BucketStorage< T >::cbegin() const noexcept
-{
-	return const_iterator(head->head, head);
-}
-template< typename T >
-typename BucketStorage< T >::iterator BucketStorage< T >::get_to_distance(iterator it, const BucketStorage::difference_type distance)
-{
-	if (distance < 0)
-		for (int i = 0; i < -1 * distance; ++i)
-			--it;
-	else
-		for (int i = 0; i < distance; i++)
-			++it;
-	return it;
-}
-
-template< typename T >
-void BucketStorage< T >::swap(BucketStorage &other) noexcept
-{
-	if (&other == this)
-		return;
-	Block *tmp_first = other.head;
-	Block *tmp_last = other.tail;
-	size_t tmp_size = other.elements;
-	size_t tmp_blocks = other.n;
-	size_t tmp_capacity = other.block_capacity;
-	other.head = head;
-	other.tail = tail;
-	other.elements = elements;
-	other.n = n;
-	other.block_capacity = block_capacity;
-	head = tmp_first;
-	tail = tmp_last;
-	elements = tmp_size;
-	n = tmp_blocks;
-	block_capacity = tmp_capacity;
-}
-
-template< typename T >
-void BucketStorage< T >::shrink_to_fit()
-{
-	size_t c = elements / block_capacity;
-	if (c * block_capacity < elements)
-		c++;
-	while (n > c)
-	{
-		insert(std::move(tail->data[tail->tail]));
-		erase(const_iterator(tail->tail, tail));
-	}
-}
-
-template< typename T >
-BucketStorage< T > &BucketStorage< T >::operator=(const BucketStorage< T > &other)
-{
-	if (this == &other)
-		return *this;
-
-	elements = other.elements;
-	n = other.n;
-	block_capacity = other.block_capacity;
-
-	this->head = new Block(*other.head);
-	Block *current = this->head;
-	while (current->fwd != nullptr)
-	{
-		current = current->fwd;
-	}
-	this->tail = current;
-	return *this;
-}
-
-template< typename T >
-BucketStorage< T > &BucketStorage< T >::operator=(BucketStorage< T > &&other) noexcept
-{
-	if (this == &other)
-		return *this;
-	head = other.head;
-	tail = other.tail;
-	n = other.n;
-	elements = other.elements;
-	block_capacity = other.block_capacity;
-	other.head = nullptr;
-	other.tail = nullptr;
-	return *this;
-}
-
-template< typename T >
-BucketStorage< T >::~BucketStorage()
-{
-	if (head != nullptr)
-	{
-		while (head->fwd != nullptr)
-			head->fwd->~Block();
-		head->~Block();
-	}
-	head = nullptr;
-	tail = nullptr;
-	elements = 0;
-	n = 0;
-}
-template< typename T >
-BucketStorage< T >::Block::Block(size_t capacity, BucketStorage::Block *bwd, size_t block_number) :
-	capacity(capacity), size(0), bwd(bwd), fwd(nullptr), block_number(block_number), head(0), tail(0),
-	deleted(new size_t[capacity]), deleted_count(0), activity(new size_t[capacity]),
-	data(static_cast< T * >(malloc(sizeof(T) * capacity)))
-{
-}
-template< typename T >
-BucketStorage< T >::Block::Block(const BucketStorage< T >::Block &other) :
-	size(other.size), capacity(other.capacity), bwd(nullptr), block_number(other.block_number), head(other.head),
-	tail(other.tail), deleted(new size_t[capacity]), deleted_count(other.deleted_count), activity(new size_t[capacity]),
-	data(static_cast< T * >(malloc(sizeof(T) * capacity)))
-{
-	std::memcpy(activity, other.activity, sizeof(size_t) * capacity);
-	std::memcpy(deleted, other.deleted, sizeof(size_t) * capacity);
-	if (other.fwd != nullptr)
-		this->fwd = new Block(*fwd);
-	this->fwd->bwd = this;
-	std::memcpy(data, other.data, sizeof(T) * capacity);
-}
-template< typename T >
-BucketStorage< T >::Block::~Block()
-{
-	if (bwd != nullptr)
-		bwd->fwd = this->fwd;
-	if (fwd != nullptr)
-		fwd->bwd = this->bwd;
-	size_t i = head;
-	while (size != 0)
-	{
-		erase(i);
-		i = next(i);
-	}
-	delete[] deleted;
-	delete[] activity;
-	free(data);
-}
-template< typename T >
-typename BucketStorage< T >::iterator BucketStorage< T >::Block::insert()
-{
-	if (size == 0)
-	{
-		activity[0] = 0;
-		size++;
-		return iterator(0, this);
-	}
-	if (size == capacity)
-	{
-		if (fwd == nullptr)
-			fwd = new Block(capacity, this, block_number + 1);
-		return fwd->insert();
-	}
-	if (deleted_count == 0)
-	{
-		activity[++tail] = 0;
-		size++;
-		return iterator(tail, this);
-	}
-	size++;
-	size_t i = deleted[--deleted_count];
-	if (i < head)
-	{
-		activity[i + 1] = head - i - 1;
-		activity[head - 1] = activity[i + 1];
-		head = i;
-		return iterator(i, this);
-	}
-	if (i >= tail)
-	{
-		tail++;
-		activity[tail] = 0;
-
-		return iterator(tail, this);
-	}
-	if (isActive(i + 1))
-	{
-		activity[i - 1] = activity[i] - 1;
-		activity[i - activity[i - 1]] = activity[i - 1];
-	}
-	else if (isActive(i - 1))
-	{
-		activity[i + 1] = activity[i] - 1;
-		activity[i + activity[i + 1]] = activity[i + 1];
-	}
-	else
-	{
-		size_t next_id = i + activity[i] - 1;
-		size_t prev_id = next_id - activity[next_id] + 1;
-		size_t nxt = activity[i] - 1;
-		size_t prv = activity[prev_id] - activity[i];
-		activity[i + 1] = nxt;
-		activity[next_id] = nxt;
-		activity[prev_id] = prv;
-		activity[i - 1] = prv;
-		activity[i] = 0;
-	}
-	return iterator(i, this);
-}
-template< typename T >
-size_t BucketStorage< T >::Block::erase(size_t i)
-{
-	data[i].~T();
-	size--;
-	if (i == tail)
-	{
-		tail = i - 1 - activity[i - 1];
-		return 0;
-	}
-	deleted[deleted_count++] = i;
-	if (i == head)
-	{
-		head = i + 1 + activity[i + 1];
-		return head;
-	}
-	if (isActive(i + 1))
-	{
-		activity[i] = activity[i - 1] + 1;
-		activity[i - activity[i] + 1] = activity[i];
-	}
-	else if (isActive(i - 1))
-	{
-		activity[i] = activity[i + 1] + 1;
-		activity[i + activity[i] - 1] = activity[i];
-	}
-	else
-	{
-		size_t prv = activity[i - activity[i - 1]] + activity[i + 1] + 1;
-		size_t curr = activity[i + 1] + 1;
-		size_t nxt = activity[i + activity[i + 1]] + activity[i - 1] + 1;
-		size_t prev_id = i - activity[i - 1];
-		size_t next_id = i + activity[i + 1];
-		activity[i] = curr;
-		activity[prev_id] = prv;
-		activity[next_id] = nxt;
-	}
-	return next(i);
-}
-
-template< typename T >
-size_t BucketStorage< T >::Block::next(size_t current) const
-{
-	if (current == tail)
-		return 0;
-	return activity[current + 1] + current + 1;
-}
-
-template< typename T >
-size_t BucketStorage< T >::Block::previous(size_t current) const
-{
-	if (current == head)
-		return capacity;
-	if (current == capacity)
-		return tail;
-	return current - activity[current - 1] - 1;
-}
-
-template< typename T >
-bool BucketStorage< T >::Block::isActive(size_t i)
-{
-	return activity[i] == 0 && i >= head && i <= tail;
-}
-
-template< typename T >
-iterator< T >::iterator(size_t i, typename BucketStorage< T >::Block *current) : i(i), block(current)
-{
-}
-
-template< typename T >
-iterator< T >::iterator(const const_iterator< T > &other) : iterator(other.i, other.block)
-{
-}
-
-template< typename T >
-iterator< T > &iterator< T >::operator++()
-{
-	i = block->next(i);
-	if (i == 0)
-	{
-		if (block->fwd != nullptr)
-		{
-			block = block->fwd;
-			i = block->head;
-		}
-		else
-		{
-			i = block->capacity;
-		}
-	}
-	return *this;
-}
-template< typename T >
-iterator< T > iterator< T >::operator++(int)
-{
-	iterator< T > tmp = *this;
-	++(*this);
-	return tmp;
-}
-template< typename T >
-iterator< T > &iterator< T >::operator--()
-{
-	i = block->previous(i);
-	if (i == block->capacity)
-	{
-		if (block->bwd != nullptr)
-		{
-			block = block->bwd;
-			i = block->tail;
-		}
-		else
-		{
-			i = block->head;
-		}
-	}
-	return *this;
-}
-template< typename T >
-iterator< T > iterator< T >::operator--(int)
-{
-	iterator< T > tmp = *this;
-	--(*this);
-	return tmp;
-}
-template< typename T >
-iterator< T >::reference_type iterator< T >::operator*()
-{
-	return block->data[i];
-}
-template< typename T >
-iterator< T >::pointer_type iterator< T >::operator->() const
-{
-	return &block->data[i];
-}
-
-template< typename T >
-bool iterator< T >::operator==(const iterator< T > &a) const
-{
-	return block == a.block && i == a.i;
-}
-
-template< typename T >
-bool iterator< T >::operator==(const const_iterator< T > &a) const
-{
-	return *this == iterator< T >(a);
-}
-template< typename T >
-bool iterator< T >::operator<(const iterator< T > &a) const
-{
-	return block->block_number < a.block->block_number || block == a.block && i < a.i;
-}
-template< typename T >
-bool iterator< T >::operator<=(const iterator< T > &a) const
-{
-	return *this < a || *this == a;
-}
-template< typename T >
-bool iterator< T >::operator>=(const iterator< T > &a) const
-{
-	return *this > a || *this == a;
-}
-
-template< typename T >
-iterator< T > &iterator< T >::operator=(iterator< T > a)
-{
-	block = a.block;
-	i = a.i;
-	return *this;
-}
-template< typename T >
-const_iterator< T >::const_iterator(size_t i, typename BucketStorage< T >::Block *current) : i(i), block(current)
-{
-}
-
-template< typename T >
-const_iterator< T >::const_iterator(const iterator< T > &other) : const_iterator(other.i, other.block)
-{
-}
-
-template< typename T >
-const_iterator< T > &const_iterator< T >::operator++()
-{
-	i = block->next(i);
-	if (i == 0)
-	{
-		if (block->fwd != nullptr)
-		{
-			block = block->fwd;
-			i = block->head;
-		}
-		else
-		{
-			i = block->capacity;
-		}
-	}
-	return *this;
-}
-template< typename T >
-const_iterator< T > const_iterator< T >::operator++(int)
-{
-	const_iterator< T > tmp = *this;
-	++(*this);
-	return tmp;
-}
-template< typename T >
-const_iterator< T > &const_iterator< T >::operator--()
-{
-	i = block->previous(i);
-	if (i == block->capacity)
-	{
-		if (block->bwd != nullptr)
-		{
-			block = block->bwd;
-			i = block->tail;
-		}
-		else
-		{
-			i = block->begin;
-		}
-	}
-	return this;
-}
-template< typename T >
-const_iterator< T > const_iterator< T >::operator--(int)
-{
-	const_iterator< T > tmp = *this;
-	*this --;
-	return tmp;
-}
-template< typename T >
-const_iterator< T >::value_type const_iterator< T >::operator*()
-{
-	return block->data[i];
-}
-template< typename T >
-const_iterator< T >::reference_type const_iterator< T >::operator->() const
-{
-	return block->data[i];
-}
-
-template< typename T >
-bool const_iterator< T >::operator==(const const_iterator< T > &a) const
-{
-	return block == a.block && i = a.i;
-}
-
-template< typename T >
-bool const_iterator< T >::operator<(const const_iterator< T > &a) const
-{
-	return block->block_number < a.block->block_number || block == a.block && i < a.i;
-}
-template< typename T >
-bool const_iterator< T >::operator<=(const const_iterator< T > &a) const
-{
-	return *this < a || *this == a;
-}
-
-template< typename T >
-bool const_iterator< T >::operator>=(const const_iterator< T > &a) const
-{
-	return *this > a || *this == a;
-}
-
-template< typename T >
-const_iterator< T > &const_iterator< T >::operator=(const_iterator< T > a)
-{
-	block = a.block;
-	i = a.i;
-	return *this;
-}
-
-#endif
+#ifndef BUCKET_STORAGE
+#define BUCKET_STORAGE
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <expected>
+#include <functional>
+#include <initializer_list>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <span>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if __has_include(<sys/mman.h>)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+template< typename Storage >
+class iterator;
+
+template< typename Storage >
+class const_iterator;
+
+template< size_t Capacity >
+struct BlockSlots
+{
+	static constexpr size_t capacity = Capacity;
+	static constexpr size_t trailing(size_t) noexcept { return 0; }
+
+	BlockSlots(size_t, uint64_t *) noexcept {}
+	uint64_t occupied[(Capacity + 63) / 64];
+	uint64_t stamps[Capacity];
+};
+
+template<>
+struct BlockSlots< 0 >
+{
+	static constexpr size_t trailing(size_t capacity) noexcept
+	{
+		return sizeof(uint64_t) * ((capacity + 63) / 64 + capacity);
+	}
+
+	BlockSlots(size_t capacity, uint64_t *trailer) noexcept :
+		capacity(capacity), occupied(trailer), stamps(trailer + (capacity + 63) / 64)
+	{
+	}
+	const size_t capacity;
+	uint64_t *occupied;
+	uint64_t *stamps;
+};
+
+template< typename T, typename Allocator = std::allocator< T >, size_t Capacity = 0, size_t InlineCapacity = 0 >
+class BucketStorage
+{
+  public:
+	using value_type = T;
+	using allocator_type = Allocator;
+	using pointer = T *;
+	using const_pointer = const T *;
+	using reference = T &;
+	using const_reference = const T &;
+	using difference_type = long;
+	using size_type = size_t;
+	using iterator = ::iterator< BucketStorage >;
+	using const_iterator = ::const_iterator< BucketStorage >;
+	static_assert(std::is_same_v< typename std::allocator_traits< Allocator >::value_type, T >);
+	static_assert(Capacity == 0 || InlineCapacity == 0 || InlineCapacity == Capacity);
+	friend iterator;
+	friend const_iterator;
+	class bucket;
+	struct handle;
+	struct fragmentation_info;
+#ifdef BUCKET_STORAGE_STATS
+	struct statistics;
+#endif
+	enum class slot_reuse
+	{
+		recent,
+		densest,
+	};
+	enum class block_growth
+	{
+		fixed,
+		geometric,
+	};
+	template< typename V >
+	class segment_iterator;
+	template< typename V >
+	class segment_range;
+	static constexpr size_t default_capacity = Capacity != 0 ? Capacity : 64;
+	static constexpr size_t default_max_capacity = Capacity != 0 ? Capacity : 8192;
+
+  public:
+	BucketStorage(BucketStorage const &other);
+	BucketStorage(BucketStorage const &other, const Allocator &alloc);
+	BucketStorage(BucketStorage &&other) noexcept(nothrow_relocate);
+	BucketStorage(BucketStorage &&other, const Allocator &alloc);
+	explicit BucketStorage(const Allocator &alloc);
+	explicit BucketStorage(size_t block_capacity = default_capacity, size_t pool_limit = 1, const Allocator &alloc = Allocator());
+	explicit BucketStorage(block_growth growth, size_t block_capacity = default_capacity, size_t max_block_capacity = default_max_capacity, const Allocator &alloc = Allocator());
+	template< std::input_iterator InputIt >
+	BucketStorage(InputIt first, InputIt last, size_t block_capacity = default_capacity, const Allocator &alloc = Allocator());
+	BucketStorage(std::initializer_list< T > values, size_t block_capacity = default_capacity, const Allocator &alloc = Allocator());
+
+	allocator_type get_allocator() const noexcept;
+
+	iterator insert(const T &value);
+	iterator insert(T &&value);
+	void insert(std::initializer_list< T > values);
+	template< std::input_iterator InputIt >
+	void insert_range(InputIt first, InputIt last);
+	template< typename... Args >
+	iterator emplace(Args &&...args);
+
+	iterator erase(const_iterator it) noexcept;
+	iterator erase(const T *element) noexcept;
+	iterator iterator_to(const T *element) noexcept;
+	const_iterator iterator_to(const T *element) const noexcept;
+
+	bool empty() const noexcept;
+
+	size_t size() const noexcept;
+	size_t capacity() const noexcept;
+	size_t pool_limit() const noexcept;
+	void set_pool_limit(size_t limit) noexcept;
+	bool huge_pages() const noexcept;
+	void set_huge_pages(bool enabled) noexcept;
+	slot_reuse reuse_policy() const noexcept;
+	void set_reuse_policy(slot_reuse policy) noexcept;
+	block_growth growth_policy() const noexcept;
+	size_t max_block_capacity() const noexcept;
+	void set_growth_policy(block_growth growth, size_t max_block_capacity = default_max_capacity) noexcept;
+	fragmentation_info fragmentation() const noexcept;
+#ifdef BUCKET_STORAGE_STATS
+	statistics stats() const noexcept;
+	void reset_stats() noexcept;
+#endif
+	void shrink_to_fit();
+	bool compact_step(size_t budget);
+	template< typename Relocate >
+	bool compact_step(size_t budget, Relocate relocate);
+	void clear();
+	void swap(BucketStorage &other) noexcept(nothrow_relocate);
+	void splice(BucketStorage &&other);
+	iterator begin() noexcept;
+	const_iterator begin() const noexcept;
+	const_iterator cbegin() const noexcept;
+	iterator end() noexcept;
+	const_iterator end() const noexcept;
+	const_iterator cend() const noexcept;
+
+	iterator get_to_distance(iterator it, difference_type distance);
+	iterator nth(size_type rank) noexcept;
+	const_iterator nth(size_type rank) const noexcept;
+	size_type rank(const_iterator it) const noexcept;
+	difference_type distance(const_iterator first, const_iterator last) const noexcept;
+
+	handle handle_of(const_iterator it) const noexcept;
+	T *get(handle h) noexcept;
+	const T *get(handle h) const noexcept;
+
+	std::span< const bucket > buckets() noexcept;
+	segment_range< T > segments() noexcept;
+	segment_range< const T > segments() const noexcept;
+	template< typename F >
+	void parallel_for_each(F f, size_t threads = 0);
+	template< typename U, typename Reduce, typename Transform = std::identity >
+	U parallel_reduce(U init, Reduce reduce, Transform transform = {}, size_t threads = 0) const;
+
+	void save(const char *path) const
+		requires std::is_trivially_copyable_v< T >;
+#if __has_include(<sys/mman.h>)
+	static BucketStorage map(const char *path, const Allocator &alloc = Allocator())
+		requires std::is_trivially_copyable_v< T >;
+#endif
+
+	BucketStorage &operator=(const BucketStorage &other);
+	BucketStorage &operator=(BucketStorage &&other) noexcept(
+		(std::allocator_traits< Allocator >::propagate_on_container_move_assignment::value ||
+		 std::allocator_traits< Allocator >::is_always_equal::value) &&
+		nothrow_relocate);
+	~BucketStorage();
+
+  private:
+	using alloc_traits = std::allocator_traits< Allocator >;
+	static constexpr bool nothrow_relocate = InlineCapacity == 0 || std::is_nothrow_move_constructible_v< T >;
+
+	struct Snapshot
+	{
+		char magic[8];
+		uint64_t version;
+		uint64_t header_size;
+		uint64_t value_size;
+		uint64_t value_alignment;
+		uint64_t fixed_capacity;
+		uint64_t block_capacity;
+		uint64_t blocks;
+		uint64_t elements;
+		uint64_t generation;
+		uint64_t length;
+		uint64_t live;
+	};
+	static constexpr char snapshot_magic[8] = { 'B', 'K', 'T', 'S', 'T', 'O', 'R', 'E' };
+	static constexpr uint64_t snapshot_version = 3;
+	static constexpr size_t snapshot_page = 4096;
+
+	class Block : public BlockSlots< Capacity >
+	{
+	  public:
+		using BlockSlots< Capacity >::capacity;
+		using BlockSlots< Capacity >::occupied;
+		using BlockSlots< Capacity >::stamps;
+
+		static constexpr size_t word_bits = 64;
+		static constexpr size_t cache_line = 64;
+		static constexpr size_t huge_page = size_t(2) << 20;
+
+		struct alignas(alignof(T) > cache_line ? alignof(T) : cache_line) line
+		{
+			unsigned char bytes[alignof(T) > cache_line ? alignof(T) : cache_line];
+		};
+		struct alignas(huge_page) page
+		{
+			unsigned char bytes[huge_page];
+		};
+
+		static Block *create(size_t capacity, size_t block_number, bool huge, Allocator &alloc);
+		static Block *revive(unsigned char *image, size_t capacity, size_t block_number, Snapshot *mapping);
+		static void destroy(Block *block, Allocator &alloc) noexcept;
+		template< typename Unit >
+		static void *allocateUnits(Allocator &alloc, size_t count);
+		template< typename Unit >
+		static void deallocateUnits(Allocator &alloc, void *memory, size_t count) noexcept;
+		static constexpr size_t alignment() noexcept;
+		static constexpr size_t dataOffset(size_t capacity) noexcept;
+		static constexpr size_t bytes(size_t capacity) noexcept;
+
+		Block(size_t capacity, size_t block_number, bool huge);
+		Block(const Block &other) = delete;
+		~Block() = default;
+		T *data;
+		Block *fwd;
+		Block *bwd;
+		size_t size;
+		size_t block_number;
+		Block *prev_vacant;
+		Block *next_vacant;
+		size_t vacant_level;
+		const bool huge;
+		Snapshot *mapping;
+		uint64_t stamp_base;
+		uint64_t stamp(size_t i) const;
+		void setStamp(size_t i, uint64_t generation);
+		size_t vacantSlot() const;
+		size_t rank(size_t i) const;
+		size_t select(size_t k) const;
+		void occupy(size_t i);
+		size_t erase(size_t i, Allocator &alloc);
+		void clear(Allocator &alloc) noexcept;
+		void destroyElements(Allocator &alloc) noexcept;
+		size_t words() const;
+		size_t first() const;
+		size_t last() const;
+		size_t seek(size_t from) const;
+		size_t runEnd(size_t from) const;
+		size_t next(size_t current) const;
+		size_t previous(size_t current) const;
+		bool isActive(size_t i) const;
+	};
+
+  public:
+	struct handle
+	{
+		size_t block;
+		size_t slot;
+		uint64_t generation;
+
+		bool operator==(const handle &other) const = default;
+	};
+
+	struct fragmentation_info
+	{
+		size_type blocks;
+		size_type partial_blocks;
+		size_type slots;
+		size_type elements;
+		size_type runs;
+
+		double utilization() const noexcept { return slots == 0 ? 1.0 : static_cast< double >(elements) / slots; }
+	};
+
+#ifdef BUCKET_STORAGE_STATS
+	struct statistics
+	{
+		size_type blocks;
+		size_type slots;
+		size_type elements;
+		std::array< size_type, 10 > occupancy;
+		double fragmentation;
+		size_type metadata_bytes;
+		size_type inserts;
+		size_type growing_inserts;
+		size_type reused_slots;
+		size_type erases;
+		size_type block_allocations;
+		size_type block_frees;
+		size_type pool_hits;
+	};
+#endif
+
+	class bucket
+	{
+	  public:
+		iterator begin() const noexcept;
+		iterator end() const noexcept;
+		const_iterator cbegin() const noexcept;
+		const_iterator cend() const noexcept;
+		size_type size() const noexcept;
+		bool empty() const noexcept;
+
+	  private:
+		friend BucketStorage;
+		Block *block = nullptr;
+	};
+
+	template< typename V >
+	class segment_iterator
+	{
+	  public:
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = std::span< V >;
+		using pointer = const std::span< V > *;
+		using reference = const std::span< V > &;
+		using difference_type = long;
+
+		segment_iterator() = default;
+
+		segment_iterator &operator++();
+		segment_iterator operator++(int);
+
+		reference operator*() const;
+		pointer operator->() const;
+
+		bool operator==(const segment_iterator &a) const;
+
+	  private:
+		friend BucketStorage;
+		segment_iterator(Block *block, size_t position);
+		void settle();
+		Block *block = nullptr;
+		size_t position = 0;
+		std::span< V > run;
+	};
+
+	template< typename V >
+	class segment_range
+	{
+	  public:
+		segment_iterator< V > begin() const;
+		segment_iterator< V > end() const;
+
+	  private:
+		friend BucketStorage;
+		explicit segment_range(Block *head);
+		Block *head;
+	};
+
+  private:
+	Block *reserve();
+	template< typename InputIt >
+	void fill(Block *block, InputIt &first, InputIt last);
+	void dropEmptyBlocks() noexcept;
+	size_t nextCapacity() const noexcept;
+	Block *grow(size_t capacity);
+	void indexBlock(Block *block);
+	void indexLocal();
+	void trimDirectory() noexcept;
+	size_t takeHole() noexcept;
+	void vacateIndex(size_t index) noexcept;
+	void rebuildHoles() noexcept;
+	void ensureTables();
+	void dropTables() noexcept;
+	size_t indexed() const noexcept;
+	void append(Block *block) noexcept;
+	void linkAfter(Block *prev, Block *block) noexcept;
+	Block *allocate(size_t block_number, size_t capacity);
+	Block *makeLocal() noexcept;
+	void moveLocal(BucketStorage &other);
+	void release(Block *block) noexcept;
+	void unlink(Block *block) noexcept;
+	void trimPool(size_t limit) noexcept;
+	void copyFrom(const BucketStorage &other);
+	void adopt(BucketStorage &other) noexcept(nothrow_relocate);
+	void moveFrom(BucketStorage &other);
+	Block *firstVacant() const noexcept;
+	size_t vacantLevel(const Block *block) const noexcept;
+	void pushVacant(Block *block) noexcept;
+	void popVacant(Block *block) noexcept;
+	void updateVacant(Block *block) noexcept;
+	void addRank(size_t block_number, difference_type delta) noexcept;
+	size_t rankBefore(size_t block_number) const noexcept;
+	Block *blockAt(size_t &rank) const noexcept;
+	Block *findBlock(size_t block_number) const noexcept;
+	Block *owner(const T *element) const noexcept;
+	std::vector< size_t > partition(size_t chunks) const;
+	template< typename Body >
+	void runParallel(const std::vector< size_t > &bounds, size_t threads, Body body) const;
+	using bucket_allocator = typename alloc_traits::template rebind_alloc< bucket >;
+	using rank_allocator = typename alloc_traits::template rebind_alloc< size_t >;
+	using address_allocator = typename alloc_traits::template rebind_alloc< std::pair< const T *const, Block * > >;
+	struct alignas(typename Block::line) InlineBlock
+	{
+		unsigned char bytes[Block::bytes(InlineCapacity)];
+		bucket entry;
+	};
+	struct NoInlineBlock
+	{
+	};
+	static constexpr size_t vacant_levels = 8;
+	struct Tables
+	{
+		explicit Tables(const Allocator &alloc);
+
+		std::vector< bucket, bucket_allocator > directory;
+		std::vector< size_t, rank_allocator > fenwick;
+		std::vector< size_t, rank_allocator > holes;
+		std::map< const T *, Block *, std::less<>, address_allocator > addresses;
+		std::array< Block *, vacant_levels > vacant;
+		Block *pool;
+		size_type pooled;
+	};
+	using tables_allocator = typename alloc_traits::template rebind_alloc< Tables >;
+	using tables_traits = typename alloc_traits::template rebind_traits< Tables >;
+	[[no_unique_address]] Allocator alloc;
+	Tables *tables;
+	Block *head;
+	Block *tail;
+	uint8_t vacant_mask;
+	slot_reuse policy;
+	bool use_huge_pages;
+	bool local_free;
+	size_type n;
+	size_type elements;
+	size_type block_capacity;
+	size_type growth_limit;
+	size_type max_pooled;
+	uint64_t generation;
+	size_type slots;
+#ifdef BUCKET_STORAGE_STATS
+	static constexpr uint64_t unused_stamp = ~uint64_t(0);
+	// Estimated per-node overhead of std::map beyond its value: parent, left and right links plus the colour word.
+	static constexpr size_t address_node_overhead = 4 * sizeof(void *);
+	statistics counters{};
+#endif
+	[[no_unique_address]] std::conditional_t< InlineCapacity != 0, InlineBlock, NoInlineBlock > local_storage;
+	Block *local;
+};
+
+namespace pmr
+{
+	template< typename T, size_t Capacity = 0, size_t InlineCapacity = 0 >
+	using BucketStorage = ::BucketStorage< T, std::pmr::polymorphic_allocator< T >, Capacity, InlineCapacity >;
+}
+
+template< typename T, size_t N, typename Allocator = std::allocator< T > >
+using FixedBucketStorage = BucketStorage< T, Allocator, N >;
+
+template< typename T, size_t N, typename Allocator = std::allocator< T > >
+using SmallBucketStorage = BucketStorage< T, Allocator, 0, N >;
+
+template< typename Storage >
+class iterator
+{
+  public:
+	using iterator_category = std::bidirectional_iterator_tag;
+	using value_type = typename Storage::value_type;
+	using pointer = typename Storage::pointer;
+	using reference = typename Storage::reference;
+	using difference_type = typename Storage::difference_type;
+	friend class const_iterator< Storage >;
+	friend Storage;
+
+	iterator(size_t i, typename Storage::Block *current);
+	explicit iterator(const const_iterator< Storage > &other);
+
+	iterator< Storage > &operator++();
+	iterator< Storage > operator++(int);
+	iterator< Storage > &operator--();
+	iterator< Storage > operator--(int);
+
+	reference operator*() const;
+	pointer operator->() const;
+
+	bool operator==(const iterator< Storage > &a) const;
+	bool operator==(const const_iterator< Storage > &a) const;
+	bool operator<(const iterator< Storage > &a) const;
+	bool operator<=(const iterator< Storage > &a) const;
+	bool operator>(const iterator< Storage > &a) const;
+
+	bool operator>=(const iterator< Storage > &a) const;
+	iterator< Storage > &operator=(iterator< Storage > a);
+
+  private:
+	typename Storage::Block *block;
+	size_t i;
+};
+
+template< typename Storage >
+class const_iterator
+{
+  public:
+	using iterator_category = std::bidirectional_iterator_tag;
+	using value_type = typename Storage::value_type;
+	using pointer = typename Storage::const_pointer;
+	using reference = typename Storage::const_reference;
+	using difference_type = typename Storage::difference_type;
+	friend Storage;
+	friend class iterator< Storage >;
+
+	const_iterator(size_t i, typename Storage::Block *current);
+	const_iterator(const iterator< Storage > &other);
+
+	const_iterator< Storage > &operator++();
+	const_iterator< Storage > operator++(int);
+	const_iterator< Storage > &operator--();
+	const_iterator< Storage > operator--(int);
+
+	reference operator*() const;
+	pointer operator->() const;
+
+	bool operator==(const const_iterator< Storage > &a) const;
+	bool operator<(const const_iterator< Storage > &a) const;
+	bool operator<=(const const_iterator< Storage > &a) const;
+	bool operator>(const const_iterator< Storage > &a) const;
+
+	bool operator>=(const const_iterator< Storage > &a) const;
+	const_iterator< Storage > &operator=(const_iterator< Storage > a);
+
+  private:
+	typename Storage::Block *block;
+	size_t i;
+};
+
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+BucketStorage< T, Allocator, Capacity, InlineCapacity >::BucketStorage(const BucketStorage &other) :
+	BucketStorage(other, alloc_traits::select_on_container_copy_construction(other.alloc))
+{
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+BucketStorage< T, Allocator, Capacity, InlineCapacity >::BucketStorage(const BucketStorage &other, const Allocator &alloc) :
+	alloc(alloc), tables(nullptr), head(nullptr), tail(nullptr), vacant_mask(0), policy(other.policy),
+	use_huge_pages(other.use_huge_pages), local_free(true), n(0), elements(0), block_capacity(other.block_capacity), growth_limit(other.growth_limit),
+	max_pooled(other.max_pooled), generation(0), slots(0), local(makeLocal())
+{
+	try
+	{
+		copyFrom(other);
+	} catch (...)
+	{
+		clear();
+		trimPool(0);
+		dropTables();
+		throw;
+	}
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+BucketStorage< T, Allocator, Capacity, InlineCapacity >::BucketStorage(BucketStorage &&other) noexcept(nothrow_relocate) :
+	alloc(std::move(other.alloc)), tables(nullptr), head(nullptr), tail(nullptr), vacant_mask(0), policy(other.policy),
+	use_huge_pages(other.use_huge_pages), local_free(true), n(0), elements(0), block_capacity(other.block_capacity), growth_limit(other.growth_limit),
+	max_pooled(other.max_pooled), generation(0), slots(0), local(makeLocal())
+{
+	adopt(other);
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+BucketStorage< T, Allocator, Capacity, InlineCapacity >::BucketStorage(BucketStorage &&other, const Allocator &alloc) :
+	BucketStorage(other.block_capacity, other.max_pooled, alloc)
+{
+	growth_limit = other.growth_limit;
+	use_huge_pages = other.use_huge_pages;
+	policy = other.policy;
+	if (this->alloc == other.alloc)
+		adopt(other);
+	else
+		moveFrom(other);
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+BucketStorage< T, Allocator, Capacity, InlineCapacity >::BucketStorage(const Allocator &alloc) : BucketStorage(64, 1, alloc)
+{
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+BucketStorage< T, Allocator, Capacity, InlineCapacity >::BucketStorage(const size_t block_capacity, const size_t pool_limit, const Allocator &alloc) :
+	alloc(alloc), tables(nullptr), head(nullptr), tail(nullptr), vacant_mask(0), policy(slot_reuse::recent), use_huge_pages(false), local_free(true),
+	n(0), elements(0), block_capacity(Capacity != 0 ? Capacity : block_capacity), growth_limit(this->block_capacity),
+	max_pooled(pool_limit), generation(0), slots(0), local(makeLocal())
+{
+}
+
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+BucketStorage< T, Allocator, Capacity, InlineCapacity >::BucketStorage(const block_growth growth, const size_t block_capacity, const size_t max_block_capacity, const Allocator &alloc) :
+	BucketStorage(block_capacity, 1, alloc)
+{
+	set_growth_policy(growth, max_block_capacity);
+}
+
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+template< std::input_iterator InputIt >
+BucketStorage< T, Allocator, Capacity, InlineCapacity >::BucketStorage(InputIt first, InputIt last, const size_t block_capacity, const Allocator &alloc) :
+	BucketStorage(block_capacity, 1, alloc)
+{
+	insert_range(first, last);
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+BucketStorage< T, Allocator, Capacity, InlineCapacity >::BucketStorage(std::initializer_list< T > values, const size_t block_capacity, const Allocator &alloc) :
+	BucketStorage(block_capacity, 1, alloc)
+{
+	insert_range(values.begin(), values.end());
+}
+
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+typename BucketStorage< T, Allocator, Capacity, InlineCapacity >::allocator_type BucketStorage< T, Allocator, Capacity, InlineCapacity >::get_allocator() const noexcept
+{
+	return alloc;
+}
+
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+typename BucketStorage< T, Allocator, Capacity, InlineCapacity >::iterator BucketStorage< T, Allocator, Capacity, InlineCapacity >::insert(const T &value)
+{
+	return emplace(value);
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+typename BucketStorage< T, Allocator, Capacity, InlineCapacity >::iterator BucketStorage< T, Allocator, Capacity, InlineCapacity >::insert(T &&value)
+{
+	return emplace(std::move(value));
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+void BucketStorage< T, Allocator, Capacity, InlineCapacity >::insert(std::initializer_list< T > values)
+{
+	insert_range(values.begin(), values.end());
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+template< std::input_iterator InputIt >
+void BucketStorage< T, Allocator, Capacity, InlineCapacity >::insert_range(InputIt first, InputIt last)
+{
+	while (vacant_mask != 0 && first != last)
+		fill(firstVacant(), first, last);
+	if (first == last)
+		return;
+	try
+	{
+		if constexpr (std::forward_iterator< InputIt >)
+		{
+			size_t count = std::distance(first, last);
+			size_t grown = 0;
+			Block *block = nullptr;
+			for (size_t reserved = 0; reserved < count; grown++)
+			{
+				block = grow(nextCapacity());
+				reserved += block->capacity;
+			}
+			for (; grown != 0; block = block->bwd)
+				if (block->size == 0)
+				{
+					pushVacant(block);
+					grown--;
+				}
+		}
+		while (first != last)
+			fill(reserve(), first, last);
+	} catch (...)
+	{
+		dropEmptyBlocks();
+		throw;
+	}
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+template< typename InputIt >
+void BucketStorage< T, Allocator, Capacity, InlineCapacity >::fill(Block *block, InputIt &first, InputIt last)
+{
+	for (size_t w = 0; w < block->words() && first != last; w++)
+	{
+		uint64_t free = ~block->occupied[w];
+		if ((w + 1) * Block::word_bits > block->capacity)
+			free &= (uint64_t(1) << block->capacity % Block::word_bits) - 1;
+		uint64_t placed = 0;
+		try
+		{
+			for (; free != 0 && first != last; ++first)
+			{
+				uint64_t bit = free & -free;
+				size_t i = w * Block::word_bits + std::countr_zero(bit);
+				alloc_traits::construct(alloc, block->data + i, *first);
+#ifdef BUCKET_STORAGE_STATS
+				counters.inserts++;
+				counters.reused_slots += block->stamps[i] != unused_stamp;
+#endif
+				block->setStamp(i, generation++);
+				placed |= bit;
+				free ^= bit;
+			}
+		} catch (...)
+		{
+			block->occupied[w] |= placed;
+			block->size += std::popcount(placed);
+			elements += std::popcount(placed);
+			addRank(block->block_number, std::popcount(placed));
+			throw;
+		}
+		block->occupied[w] |= placed;
+		block->size += std::popcount(placed);
+		elements += std::popcount(placed);
+		addRank(block->block_number, std::popcount(placed));
+	}
+	if (block->size == block->capacity)
+		popVacant(block);
+	else
+		updateVacant(block);
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+void BucketStorage< T, Allocator, Capacity, InlineCapacity >::dropEmptyBlocks() noexcept
+{
+	for (Block *block = tail; block != nullptr;)
+	{
+		Block *prev = block->bwd;
+		if (block->size == 0)
+		{
+			popVacant(block);
+			unlink(block);
+			release(block);
+		}
+		block = prev;
+	}
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+template< typename... Args >
+typename BucketStorage< T, Allocator, Capacity, InlineCapacity >::iterator BucketStorage< T, Allocator, Capacity, InlineCapacity >::emplace(Args &&...args)
+{
+	Block *block = reserve();
+	size_t i = block->vacantSlot();
+	try
+	{
+		alloc_traits::construct(alloc, block->data + i, std::forward< Args >(args)...);
+	} catch (...)
+	{
+		if (block->size == 0)
+		{
+			popVacant(block);
+			unlink(block);
+			release(block);
+		}
+		throw;
+	}
+	block->occupy(i);
+#ifdef BUCKET_STORAGE_STATS
+	counters.inserts++;
+	counters.reused_slots += block->stamps[i] != unused_stamp;
+#endif
+	block->setStamp(i, generation++);
+	addRank(block->block_number, 1);
+	if (block->size == block->capacity)
+		popVacant(block);
+	else
+		updateVacant(block);
+	elements++;
+	return iterator(i, block);
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+typename BucketStorage< T, Allocator, Capacity, InlineCapacity >::Block *BucketStorage< T, Allocator, Capacity, InlineCapacity >::reserve()
+{
+	if (vacant_mask == 0)
+	{
+#ifdef BUCKET_STORAGE_STATS
+		counters.growing_inserts++;
+#endif
+		pushVacant(grow(nextCapacity()));
+	}
+	return firstVacant();
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+size_t BucketStorage< T, Allocator, Capacity, InlineCapacity >::nextCapacity() const noexcept
+{
+	if (local != nullptr && local_free)
+		return InlineCapacity;
+	return std::clamp(slots, block_capacity, growth_limit);
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+typename BucketStorage< T, Allocator, Capacity, InlineCapacity >::Block *BucketStorage< T, Allocator, Capacity, InlineCapacity >::grow(size_t capacity)
+{
+	if constexpr (InlineCapacity != 0)
+		if (head == nullptr && indexed() == 0 && capacity == InlineCapacity && local_free)
+		{
+			local_free = false;
+			local->block_number = 0;
+			local->fwd = nullptr;
+			append(local);
+			return local;
+		}
+	ensureTables();
+	indexLocal();
+	std::vector< bucket, bucket_allocator > &directory = tables->directory;
+	size_t index = takeHole();
+	bool appended = index == directory.size();
+	if (appended)
+		indexBlock(nullptr);
+	try
+	{
+		directory[index].block = allocate(index, capacity);
+		if (directory[index].block != local)
+			tables->addresses.try_emplace(directory[index].block->data, directory[index].block);
+	} catch (...)
+	{
+		if (directory[index].block != nullptr)
+			release(directory[index].block);
+		directory[index].block = nullptr;
+		trimDirectory();
+		if (index < directory.size())
+			vacateIndex(index);
+		throw;
+	}
+	linkAfter(appended ? tail : index == 0 ? nullptr : directory[index - 1].block, directory[index].block);
+	return directory[index].block;
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+void BucketStorage< T, Allocator, Capacity, InlineCapacity >::indexBlock(Block *block)
+{
+	ensureTables();
+	std::vector< bucket, bucket_allocator > &directory = tables->directory;
+	std::vector< size_t, rank_allocator > &fenwick = tables->fenwick;
+	std::vector< size_t, rank_allocator > &holes = tables->holes;
+	size_t index = directory.size();
+	if (holes.capacity() <= index)
+		holes.reserve(std::max(directory.capacity(), index + 1));
+	directory.emplace_back();
+	try
+	{
+		fenwick.push_back(0);
+	} catch (...)
+	{
+		directory.pop_back();
+		throw;
+	}
+	directory[index].block = block;
+	size_t low = (index + 1) & ~index;
+	fenwick[index] = rankBefore(index) - rankBefore(index + 1 - low);
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+void BucketStorage< T, Allocator, Capacity, InlineCapacity >::indexLocal()
+{
+	if (indexed() != 0 || head == nullptr)
+		return;
+	indexBlock(head);
+	addRank(0, head->size);
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+void BucketStorage< T, Allocator, Capacity, InlineCapacity >::trimDirectory() noexcept
+{
+	while (!tables->directory.empty() && tables->directory.back().block == nullptr)
+	{
+		tables->directory.pop_back();
+		tables->fenwick.pop_back();
+	}
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+size_t BucketStorage< T, Allocator, Capacity, InlineCapacity >::takeHole() noexcept
+{
+	std::vector< size_t, rank_allocator > &holes = tables->holes;
+	while (!holes.empty())
+	{
+		size_t index = holes.front();
+		std::pop_heap(holes.begin(), holes.end(), std::greater<>());
+		holes.pop_back();
+		if (index < tables->directory.size() && tables->directory[index].block == nullptr)
+			return index;
+	}
+	return tables->directory.size();
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+void BucketStorage< T, Allocator, Capacity, InlineCapacity >::vacateIndex(size_t index) noexcept
+{
+	std::vector< size_t, rank_allocator > &holes = tables->holes;
+	if (holes.size() == holes.capacity())
+	{
+		rebuildHoles();
+		return;
+	}
+	holes.push_back(index);
+	std::push_heap(holes.begin(), holes.end(), std::greater<>());
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+void BucketStorage< T, Allocator, Capacity, InlineCapacity >::rebuildHoles() noexcept
+{
+	if (tables == nullptr)
+		return;
+	tables->holes.clear();
+	for (size_t index = 0; index < tables->directory.size(); index++)
+		if (tables->directory[index].block == nullptr)
+			tables->holes.push_back(index);
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+void BucketStorage< T, Allocator, Capacity, InlineCapacity >::ensureTables()
+{
+	if (tables != nullptr)
+		return;
+	tables_allocator allocator(alloc);
+	auto memory = tables_traits::allocate(allocator, 1);
+	try
+	{
+		tables_traits::construct(allocator, std::to_address(memory), alloc);
+	} catch (...)
+	{
+		tables_traits::deallocate(allocator, memory, 1);
+		throw;
+	}
+	tables = std::to_address(memory);
+	if (vacant_mask != 0)
+		tables->vacant[head->vacant_level] = head;
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+void BucketStorage< T, Allocator, Capacity, InlineCapacity >::dropTables() noexcept
+{
+	if (tables == nullptr)
+		return;
+	tables_allocator allocator(alloc);
+	tables_traits::destroy(allocator, tables);
+	tables_traits::deallocate(allocator, std::pointer_traits< typename tables_traits::pointer >::pointer_to(*tables), 1);
+	tables = nullptr;
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+size_t BucketStorage< T, Allocator, Capacity, InlineCapacity >::indexed() const noexcept
+{
+	return tables == nullptr ? 0 : tables->directory.size();
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+BucketStorage< T, Allocator, Capacity, InlineCapacity >::Tables::Tables(const Allocator &alloc) :
+	directory(bucket_allocator(alloc)), fenwick(rank_allocator(alloc)), holes(rank_allocator(alloc)), addresses(address_allocator(alloc)),
+	vacant{}, pool(nullptr), pooled(0)
+{
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+void BucketStorage< T, Allocator, Capacity, InlineCapacity >::append(Block *block) noexcept
+{
+	linkAfter(tail, block);
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+void BucketStorage< T, Allocator, Capacity, InlineCapacity >::linkAfter(Block *prev, Block *block) noexcept
+{
+	Block *next = prev == nullptr ? head : prev->fwd;
+	block->bwd = prev;
+	block->fwd = next;
+	if (prev == nullptr)
+		head = block;
+	else
+		prev->fwd = block;
+	if (next == nullptr)
+		tail = block;
+	else
+		next->bwd = block;
+	n++;
+	slots += block->capacity;
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+typename BucketStorage< T, Allocator, Capacity, InlineCapacity >::Block *BucketStorage< T, Allocator, Capacity, InlineCapacity >::allocate(size_t block_number, size_t capacity)
+{
+	if constexpr (InlineCapacity != 0)
+		if (capacity == InlineCapacity && local_free)
+		{
+			local_free = false;
+			local->block_number = block_number;
+			local->fwd = nullptr;
+			return local;
+		}
+	Block **fit = nullptr;
+	for (Block **link = &tables->pool; *link != nullptr; link = &(*link)->fwd)
+		if ((*link)->capacity >= capacity && (fit == nullptr || (*link)->capacity < (*fit)->capacity))
+			fit = link;
+	if (fit == nullptr)
+	{
+#ifdef BUCKET_STORAGE_STATS
+		counters.block_allocations++;
+#endif
+		return Block::create(capacity, block_number, use_huge_pages, alloc);
+	}
+#ifdef BUCKET_STORAGE_STATS
+	counters.pool_hits++;
+#endif
+	Block *block = *fit;
+	*fit = block->fwd;
+	tables->pooled--;
+	block->block_number = block_number;
+	block->fwd = nullptr;
+	return block;
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+void BucketStorage< T, Allocator, Capacity, InlineCapacity >::release(Block *block) noexcept
+{
+	if (block == local)
+	{
+		if (block->size != 0)
+			block->clear(alloc);
+		local_free = true;
+		return;
+	}
+	if (tables->pooled >= max_pooled)
+	{
+#ifdef BUCKET_STORAGE_STATS
+		counters.block_frees++;
+#endif
+		tables->addresses.erase(block->data);
+		Block::destroy(block, alloc);
+		return;
+	}
+	if (block->size != 0)
+		block->clear(alloc);
+	block->bwd = nullptr;
+	block->fwd = tables->pool;
+	tables->pool = block;
+	tables->pooled++;
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+void BucketStorage< T, Allocator, Capacity, InlineCapacity >::unlink(Block *block) noexcept
+{
+	if (block->bwd != nullptr)
+		block->bwd->fwd = block->fwd;
+	else
+		head = block->fwd;
+	if (block->fwd != nullptr)
+		block->fwd->bwd = block->bwd;
+	else
+		tail = block->bwd;
+	n--;
+	slots -= block->capacity;
+	addRank(block->block_number, -static_cast< difference_type >(block->size));
+	if (indexed() == 0)
+		return;
+	tables->directory[block->block_number].block = nullptr;
+	trimDirectory();
+	if (block->block_number < tables->directory.size())
+		vacateIndex(block->block_number);
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+void BucketStorage< T, Allocator, Capacity, InlineCapacity >::trimPool(size_t limit) noexcept
+{
+	if (tables == nullptr)
+		return;
+	while (tables->pooled > limit)
+	{
+		Block *block = tables->pool;
+		tables->pool = block->fwd;
+		tables->pooled--;
+#ifdef BUCKET_STORAGE_STATS
+		counters.block_frees++;
+#endif
+		tables->addresses.erase(block->data);
+		Block::destroy(block, alloc);
+	}
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+void BucketStorage< T, Allocator, Capacity, InlineCapacity >::copyFrom(const BucketStorage &other)
+{
+	generation = std::max(generation, other.generation);
+	if (other.indexed() != 0)
+	{
+		ensureTables();
+		tables->directory.reserve(other.indexed());
+		tables->fenwick.reserve(other.indexed());
+	}
+	try
+	{
+		for (Block *source = other.head; source != nullptr; source = source->fwd)
+		{
+			indexLocal();
+			while (indexed() < source->block_number)
+				indexBlock(nullptr);
+			Block *block = grow(source->capacity);
+			pushVacant(block);
+			std::memcpy(block->stamps, source->stamps, sizeof(uint64_t) * source->capacity);
+			block->stamp_base = source->stamp_base;
+			if constexpr (std::is_trivially_copyable_v< T >)
+			{
+				size_t i = source->first();
+				while (i != source->capacity)
+				{
+					size_t end = source->runEnd(i);
+					std::memcpy(static_cast< void * >(block->data + i), source->data + i, sizeof(T) * (end - i));
+					i = source->seek(end);
+				}
+				std::memcpy(block->occupied, source->occupied, sizeof(uint64_t) * source->words());
+				block->size = source->size;
+			}
+			else
+			{
+				try
+				{
+					for (size_t i = source->first(); i != source->capacity; i = source->next(i))
+					{
+						alloc_traits::construct(alloc, block->data + i, source->data[i]);
+						block->occupy(i);
+					}
+				} catch (...)
+				{
+					elements += block->size;
+					addRank(block->block_number, block->size);
+					dropEmptyBlocks();
+					throw;
+				}
+			}
+			elements += block->size;
+			addRank(block->block_number, block->size);
+			if (block->size == block->capacity)
+				popVacant(block);
+			else
+				updateVacant(block);
+		}
+	} catch (...)
+	{
+		rebuildHoles();
+		throw;
+	}
+	rebuildHoles();
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+void BucketStorage< T, Allocator, Capacity, InlineCapacity >::adopt(BucketStorage &other) noexcept(nothrow_relocate)
+{
+	if constexpr (InlineCapacity != 0)
+		if (!other.local_free)
+			moveLocal(other);
+	tables = std::exchange(other.tables, nullptr);
+	head = std::exchange(other.head, nullptr);
+	tail = std::exchange(other.tail, nullptr);
+	vacant_mask = std::exchange(other.vacant_mask, 0);
+	policy = other.policy;
+	n = std::exchange(other.n, 0);
+	elements = std::exchange(other.elements, 0);
+	slots = std::exchange(other.slots, 0);
+	block_capacity = other.block_capacity;
+	growth_limit = other.growth_limit;
+	max_pooled = other.max_pooled;
+	use_huge_pages = other.use_huge_pages;
+	generation = std::max(generation, other.generation);
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+typename BucketStorage< T, Allocator, Capacity, InlineCapacity >::Block *BucketStorage< T, Allocator, Capacity, InlineCapacity >::makeLocal() noexcept
+{
+	if constexpr (InlineCapacity != 0)
+	{
+		local_storage.entry.block = reinterpret_cast< Block * >(local_storage.bytes);
+		return new (local_storage.bytes) Block(InlineCapacity, 0, false);
+	}
+	else
+		return nullptr;
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+void BucketStorage< T, Allocator, Capacity, InlineCapacity >::moveLocal(BucketStorage &other)
+{
+	Block *source = other.local;
+	size_t i = source->first();
+	try
+	{
+		for (; i != source->capacity; i = source->next(i))
+			alloc_traits::construct(alloc, local->data + i, std::move(source->data[i]));
+	} catch (...)
+	{
+		for (size_t j = source->first(); j != i; j = source->next(j))
+			alloc_traits::destroy(alloc, local->data + j);
+		throw;
+	}
+	std::memcpy(local->occupied, source->occupied, sizeof(uint64_t) * local->words());
+	std::memcpy(local->stamps, source->stamps, sizeof(uint64_t) * local->capacity);
+	local->stamp_base = source->stamp_base;
+	local->size = source->size;
+	local->block_number = source->block_number;
+	local->fwd = source->fwd;
+	local->bwd = source->bwd;
+	local->prev_vacant = source->prev_vacant;
+	local->next_vacant = source->next_vacant;
+	local->vacant_level = source->vacant_level;
+	if (local->bwd != nullptr)
+		local->bwd->fwd = local;
+	else
+		other.head = local;
+	if (local->fwd != nullptr)
+		local->fwd->bwd = local;
+	else
+		other.tail = local;
+	if (local->prev_vacant != nullptr)
+		local->prev_vacant->next_vacant = local;
+	else if (other.tables != nullptr && other.tables->vacant[local->vacant_level] == source)
+		other.tables->vacant[local->vacant_level] = local;
+	if (local->next_vacant != nullptr)
+		local->next_vacant->prev_vacant = local;
+	if (other.indexed() != 0)
+		other.tables->directory[local->block_number].block = local;
+	source->clear(alloc);
+	other.local_free = true;
+	local_free = false;
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+void BucketStorage< T, Allocator, Capacity, InlineCapacity >::moveFrom(BucketStorage &other)
+{
+	for (T &value : other)
+		emplace(std::move(value));
+	other.clear();
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+typename BucketStorage< T, Allocator, Capacity, InlineCapacity >::Block *BucketStorage< T, Allocator, Capacity, InlineCapacity >::firstVacant() const noexcept
+{
+	if (vacant_mask == 0)
+		return nullptr;
+	if (tables == nullptr)
+		return head;
+	return tables->vacant[Block::word_bits - 1 - std::countl_zero(uint64_t(vacant_mask))];
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+size_t BucketStorage< T, Allocator, Capacity, InlineCapacity >::vacantLevel(const Block *block) const noexcept
+{
+	if (policy == slot_reuse::recent)
+		return 0;
+	return block->size * vacant_levels / block->capacity;
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+void BucketStorage< T, Allocator, Capacity, InlineCapacity >::pushVacant(Block *block) noexcept
+{
+	size_t level = vacantLevel(block);
+	block->vacant_level = level;
+	block->prev_vacant = nullptr;
+	block->next_vacant = nullptr;
+	vacant_mask |= uint8_t(1) << level;
+	if (tables == nullptr)
+		return;
+	std::array< Block *, vacant_levels > &vacant = tables->vacant;
+	block->next_vacant = vacant[level];
+	if (vacant[level] != nullptr)
+		vacant[level]->prev_vacant = block;
+	vacant[level] = block;
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+void BucketStorage< T, Allocator, Capacity, InlineCapacity >::popVacant(Block *block) noexcept
+{
+	size_t level = block->vacant_level;
+	if (tables == nullptr)
+	{
+		vacant_mask &= ~(uint8_t(1) << level);
+		return;
+	}
+	std::array< Block *, vacant_levels > &vacant = tables->vacant;
+	if (block->prev_vacant == nullptr && vacant[level] != block)
+		return;
+	if (block->prev_vacant != nullptr)
+		block->prev_vacant->next_vacant = block->next_vacant;
+	else
+	{
+		vacant[level] = block->next_vacant;
+		if (vacant[level] == nullptr)
+			vacant_mask &= ~(uint8_t(1) << level);
+	}
+	if (block->next_vacant != nullptr)
+		block->next_vacant->prev_vacant = block->prev_vacant;
+	block->prev_vacant = nullptr;
+	block->next_vacant = nullptr;
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+void BucketStorage< T, Allocator, Capacity, InlineCapacity >::updateVacant(Block *block) noexcept
+{
+	if (vacantLevel(block) == block->vacant_level)
+		return;
+	popVacant(block);
+	pushVacant(block);
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+typename BucketStorage< T, Allocator, Capacity, InlineCapacity >::iterator BucketStorage< T, Allocator, Capacity, InlineCapacity >::erase(const_iterator it) noexcept
+{
+#ifdef BUCKET_STORAGE_STATS
+	counters.erases++;
+#endif
+	elements--;
+	Block *block = it.block;
+	bool was_full = block->size == block->capacity;
+	size_t next_id = block->erase(it.i, alloc);
+	addRank(block->block_number, -1);
+	if (was_full)
+		pushVacant(block);
+	else
+		updateVacant(block);
+	if (block->size != 0)
+	{
+		if (next_id != block->capacity)
+			return iterator(next_id, block);
+		if (block->fwd == nullptr)
+			return end();
+		return iterator(block->fwd->first(), block->fwd);
+	}
+	Block *next_block = block->fwd;
+	popVacant(block);
+	unlink(block);
+	release(block);
+	if (next_block == nullptr)
+		return end();
+	return iterator(next_block->first(), next_block);
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+typename BucketStorage< T, Allocator, Capacity, InlineCapacity >::iterator BucketStorage< T, Allocator, Capacity, InlineCapacity >::erase(const T *element) noexcept
+{
+	iterator it = iterator_to(element);
+	if (it == end())
+		return it;
+	return erase(it);
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+typename BucketStorage< T, Allocator, Capacity, InlineCapacity >::iterator BucketStorage< T, Allocator, Capacity, InlineCapacity >::iterator_to(const T *element) noexcept
+{
+	return iterator(std::as_const(*this).iterator_to(element));
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+typename BucketStorage< T, Allocator, Capacity, InlineCapacity >::const_iterator BucketStorage< T, Allocator, Capacity, InlineCapacity >::iterator_to(const T *element) const noexcept
+{
+	Block *block = owner(element);
+	if (block == nullptr || !block->isActive(element - block->data))
+		return end();
+	return const_iterator(element - block->data, block);
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+void BucketStorage< T, Allocator, Capacity, InlineCapacity >::clear()
+{
+	while (head != nullptr)
+	{
+		Block *block = head;
+		head = block->fwd;
+		release(block);
+	}
+	if (tables != nullptr)
+	{
+		tables->directory.clear();
+		tables->fenwick.clear();
+		tables->holes.clear();
+		tables->vacant = {};
+	}
+	head = nullptr;
+	tail = nullptr;
+	vacant_mask = 0;
+	elements = 0;
+	n = 0;
+	slots = 0;
+}
+
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+size_t BucketStorage< T, Allocator, Capacity, InlineCapacity >::capacity() const noexcept
+{
+	return slots;
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+size_t BucketStorage< T, Allocator, Capacity, InlineCapacity >::pool_limit() const noexcept
+{
+	return max_pooled;
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+void BucketStorage< T, Allocator, Capacity, InlineCapacity >::set_pool_limit(const size_t limit) noexcept
+{
+	max_pooled = limit;
+	trimPool(limit);
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+bool BucketStorage< T, Allocator, Capacity, InlineCapacity >::huge_pages() const noexcept
+{
+	return use_huge_pages;
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+void BucketStorage< T, Allocator, Capacity, InlineCapacity >::set_huge_pages(const bool enabled) noexcept
+{
+	use_huge_pages = enabled;
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+typename BucketStorage< T, Allocator, Capacity, InlineCapacity >::slot_reuse BucketStorage< T, Allocator, Capacity, InlineCapacity >::reuse_policy() const noexcept
+{
+	return policy;
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+void BucketStorage< T, Allocator, Capacity, InlineCapacity >::set_reuse_policy(const slot_reuse policy) noexcept
+{
+	if (this->policy == policy)
+		return;
+	this->policy = policy;
+	if (tables != nullptr)
+		tables->vacant = {};
+	vacant_mask = 0;
+	for (Block *block = head; block != nullptr; block = block->fwd)
+		if (block->size != block->capacity)
+			pushVacant(block);
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+typename BucketStorage< T, Allocator, Capacity, InlineCapacity >::block_growth BucketStorage< T, Allocator, Capacity, InlineCapacity >::growth_policy() const noexcept
+{
+	return growth_limit > block_capacity ? block_growth::geometric : block_growth::fixed;
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+size_t BucketStorage< T, Allocator, Capacity, InlineCapacity >::max_block_capacity() const noexcept
+{
+	return growth_limit;
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+void BucketStorage< T, Allocator, Capacity, InlineCapacity >::set_growth_policy(const block_growth growth, const size_t max_block_capacity) noexcept
+{
+	if constexpr (Capacity != 0)
+		return;
+	growth_limit = growth == block_growth::geometric ? std::max(block_capacity, max_block_capacity) : block_capacity;
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+typename BucketStorage< T, Allocator, Capacity, InlineCapacity >::fragmentation_info BucketStorage< T, Allocator, Capacity, InlineCapacity >::fragmentation() const noexcept
+{
+	fragmentation_info info{ n, 0, slots, elements, 0 };
+	for (Block *block = head; block != nullptr; block = block->fwd)
+	{
+		if (block->size != block->capacity)
+			info.partial_blocks++;
+		uint64_t carry = 0;
+		for (size_t w = 0; w < block->words(); w++)
+		{
+			info.runs += std::popcount(block->occupied[w] & ~(block->occupied[w] << 1 | carry));
+			carry = block->occupied[w] >> (Block::word_bits - 1);
+		}
+	}
+	return info;
+}
+#ifdef BUCKET_STORAGE_STATS
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+typename BucketStorage< T, Allocator, Capacity, InlineCapacity >::statistics BucketStorage< T, Allocator, Capacity, InlineCapacity >::stats() const noexcept
+{
+	statistics result = counters;
+	result.blocks = n;
+	result.slots = slots;
+	result.elements = elements;
+	result.fragmentation = 1.0 - fragmentation().utilization();
+	result.occupancy = {};
+	result.metadata_bytes = sizeof(BucketStorage);
+	for (Block *block = head; block != nullptr; block = block->fwd)
+	{
+		result.occupancy[std::min< size_t >(result.occupancy.size() - 1, block->size * result.occupancy.size() / block->capacity)]++;
+		result.metadata_bytes += Block::dataOffset(block->capacity);
+	}
+	if (tables == nullptr)
+		return result;
+	// The address map does not expose its node size, so each entry is counted as its value plus an estimated node overhead.
+	result.metadata_bytes += sizeof(Tables) + sizeof(bucket) * tables->directory.capacity() +
+							 sizeof(size_t) * (tables->fenwick.capacity() + tables->holes.capacity()) +
+							 (sizeof(typename decltype(tables->addresses)::value_type) + address_node_overhead) * tables->addresses.size();
+	for (Block *block = tables->pool; block != nullptr; block = block->fwd)
+		result.metadata_bytes += Block::dataOffset(block->capacity);
+	return result;
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+void BucketStorage< T, Allocator, Capacity, InlineCapacity >::reset_stats() noexcept
+{
+	counters = {};
+}
+#endif
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+typename BucketStorage< T, Allocator, Capacity, InlineCapacity >::size_type BucketStorage< T, Allocator, Capacity, InlineCapacity >::size() const noexcept
+{
+	return elements;
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+bool BucketStorage< T, Allocator, Capacity, InlineCapacity >::empty() const noexcept
+{
+	return elements == 0;
+}
+
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+typename BucketStorage< T, Allocator, Capacity, InlineCapacity >::iterator BucketStorage< T, Allocator, Capacity, InlineCapacity >::end() noexcept
+{
+	return iterator(tail == nullptr ? block_capacity : tail->capacity, tail);
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+typename BucketStorage< T, Allocator, Capacity, InlineCapacity >::const_iterator BucketStorage< T, Allocator, Capacity, InlineCapacity >::end() const noexcept
+{
+	return const_iterator(tail == nullptr ? block_capacity : tail->capacity, tail);
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+typename BucketStorage< T, Allocator, Capacity, InlineCapacity >::const_iterator BucketStorage< T, Allocator, Capacity, InlineCapacity >::cend() const noexcept
+{
+	return end();
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+typename BucketStorage< T, Allocator, Capacity, InlineCapacity >::iterator BucketStorage< T, Allocator, Capacity, InlineCapacity >::begin() noexcept
+{
+	if (elements == 0)
+		return end();
+	return iterator(head->first(), head);
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+typename BucketStorage< T, Allocator, Capacity, InlineCapacity >::const_iterator BucketStorage< T, Allocator, Capacity, InlineCapacity >::begin() const noexcept
+{
+	if (elements == 0)
+		return end();
+	return const_iterator(head->first(), head);
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+typename BucketStorage< T, Allocator, Capacity, InlineCapacity >::const_iterator BucketStorage< T, Allocator, Capacity, InlineCapacity >::cbegin() const noexcept
+{
+	return begin();
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+typename BucketStorage< T, Allocator, Capacity, InlineCapacity >::iterator BucketStorage< T, Allocator, Capacity, InlineCapacity >::get_to_distance(iterator it, const BucketStorage::difference_type distance)
+{
+	difference_type target = static_cast< difference_type >(rank(it)) + distance;
+	if (target < 0)
+		return begin();
+	return nth(static_cast< size_type >(target));
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+typename BucketStorage< T, Allocator, Capacity, InlineCapacity >::iterator BucketStorage< T, Allocator, Capacity, InlineCapacity >::nth(size_type rank) noexcept
+{
+	if (rank >= elements)
+		return end();
+	Block *block = blockAt(rank);
+	return iterator(block->select(rank), block);
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+typename BucketStorage< T, Allocator, Capacity, InlineCapacity >::const_iterator BucketStorage< T, Allocator, Capacity, InlineCapacity >::nth(size_type rank) const noexcept
+{
+	if (rank >= elements)
+		return end();
+	Block *block = blockAt(rank);
+	return const_iterator(block->select(rank), block);
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+typename BucketStorage< T, Allocator, Capacity, InlineCapacity >::size_type BucketStorage< T, Allocator, Capacity, InlineCapacity >::rank(const_iterator it) const noexcept
+{
+	if (it.block == nullptr)
+		return 0;
+	return rankBefore(it.block->block_number) + it.block->rank(it.i);
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+typename BucketStorage< T, Allocator, Capacity, InlineCapacity >::difference_type BucketStorage< T, Allocator, Capacity, InlineCapacity >::distance(const_iterator first, const_iterator last) const noexcept
+{
+	return static_cast< difference_type >(rank(last)) - static_cast< difference_type >(rank(first));
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+typename BucketStorage< T, Allocator, Capacity, InlineCapacity >::handle BucketStorage< T, Allocator, Capacity, InlineCapacity >::handle_of(const_iterator it) const noexcept
+{
+	return handle{ it.block->block_number, it.i, it.block->stamp(it.i) };
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+T *BucketStorage< T, Allocator, Capacity, InlineCapacity >::get(handle h) noexcept
+{
+	return const_cast< T * >(std::as_const(*this).get(h));
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+const T *BucketStorage< T, Allocator, Capacity, InlineCapacity >::get(handle h) const noexcept
+{
+	Block *block = findBlock(h.block);
+	if (block == nullptr || !block->isActive(h.slot) || block->stamp(h.slot) != h.generation)
+		return nullptr;
+	return block->data + h.slot;
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+void BucketStorage< T, Allocator, Capacity, InlineCapacity >::addRank(size_t block_number, const difference_type delta) noexcept
+{
+	if (tables == nullptr)
+		return;
+	std::vector< size_t, rank_allocator > &fenwick = tables->fenwick;
+	for (size_t i = block_number + 1; i <= fenwick.size(); i += i & -i)
+		fenwick[i - 1] += delta;
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+size_t BucketStorage< T, Allocator, Capacity, InlineCapacity >::rankBefore(size_t block_number) const noexcept
+{
+	size_t sum = 0;
+	for (size_t i = block_number; i > 0; i -= i & -i)
+		sum += tables->fenwick[i - 1];
+	return sum;
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+typename BucketStorage< T, Allocator, Capacity, InlineCapacity >::Block *BucketStorage< T, Allocator, Capacity, InlineCapacity >::blockAt(size_t &rank) const noexcept
+{
+	if (indexed() == 0)
+		return head;
+	const std::vector< size_t, rank_allocator > &fenwick = tables->fenwick;
+	size_t position = 0;
+	for (size_t step = std::bit_floor(fenwick.size()); step != 0; step >>= 1)
+		if (position + step <= fenwick.size() && fenwick[position + step - 1] <= rank)
+		{
+			position += step;
+			rank -= fenwick[position - 1];
+		}
+	return tables->directory[position].block;
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+typename BucketStorage< T, Allocator, Capacity, InlineCapacity >::Block *BucketStorage< T, Allocator, Capacity, InlineCapacity >::findBlock(size_t block_number) const noexcept
+{
+	if (indexed() == 0)
+		return head != nullptr && head->block_number == block_number ? head : nullptr;
+	return block_number < tables->directory.size() ? tables->directory[block_number].block : nullptr;
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+typename BucketStorage< T, Allocator, Capacity, InlineCapacity >::Block *BucketStorage< T, Allocator, Capacity, InlineCapacity >::owner(const T *element) const noexcept
+{
+	if constexpr (InlineCapacity != 0)
+		if (!local_free && std::greater_equal<>()(element, local->data) && std::less<>()(element, local->data + local->capacity))
+			return local;
+	if (tables == nullptr)
+		return nullptr;
+	auto it = tables->addresses.upper_bound(element);
+	if (it == tables->addresses.begin())
+		return nullptr;
+	Block *block = std::prev(it)->second;
+	if (std::greater_equal<>()(element, block->data + block->capacity))
+		return nullptr;
+	return block;
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+std::span< const typename BucketStorage< T, Allocator, Capacity, InlineCapacity >::bucket > BucketStorage< T, Allocator, Capacity, InlineCapacity >::buckets() noexcept
+{
+	if constexpr (InlineCapacity != 0)
+		if (indexed() == 0 && head != nullptr)
+			return std::span< const bucket >(&local_storage.entry, 1);
+	if (tables == nullptr)
+		return {};
+	return tables->directory;
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+typename BucketStorage< T, Allocator, Capacity, InlineCapacity >::template segment_range< T > BucketStorage< T, Allocator, Capacity, InlineCapacity >::segments() noexcept
+{
+	return segment_range< T >(head);
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+typename BucketStorage< T, Allocator, Capacity, InlineCapacity >::template segment_range< const T > BucketStorage< T, Allocator, Capacity, InlineCapacity >::segments() const noexcept
+{
+	return segment_range< const T >(head);
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+std::vector< size_t > BucketStorage< T, Allocator, Capacity, InlineCapacity >::partition(size_t chunks) const
+{
+	std::vector< size_t > bounds(1, 0);
+	for (size_t c = 1; c < chunks && elements != 0; c++)
+	{
+		size_t rank = elements * c / chunks;
+		size_t position = blockAt(rank)->block_number;
+		if (position > bounds.back())
+			bounds.push_back(position);
+	}
+	bounds.push_back(indexed() == 0 ? n : indexed());
+	return bounds;
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+template< typename Body >
+void BucketStorage< T, Allocator, Capacity, InlineCapacity >::runParallel(const std::vector< size_t > &bounds, size_t threads, Body body) const
+{
+	std::atomic< size_t > next(0);
+	std::exception_ptr error;
+	std::mutex error_mutex;
+	size_t chunks = bounds.size() - 1;
+	auto worker = [&]
+	{
+		for (size_t chunk = next++; chunk < chunks; chunk = next++)
+		{
+			try
+			{
+				for (size_t i = bounds[chunk]; i < bounds[chunk + 1]; i++)
+					if (Block *block = findBlock(i))
+						body(block, chunk);
+			} catch (...)
+			{
+				std::lock_guard< std::mutex > lock(error_mutex);
+				if (!error)
+					error = std::current_exception();
+				next = chunks;
+			}
+		}
+	};
+	std::vector< std::thread > pool;
+	for (size_t t = 1; t < threads && t < chunks; t++)
+		pool.emplace_back(worker);
+	worker();
+	for (std::thread &thread : pool)
+		thread.join();
+	if (error)
+		std::rethrow_exception(error);
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+template< typename F >
+void BucketStorage< T, Allocator, Capacity, InlineCapacity >::parallel_for_each(F f, size_t threads)
+{
+	if (threads == 0)
+		threads = std::max< size_t >(1, std::thread::hardware_concurrency());
+	runParallel(partition(threads * 4),
+				threads,
+				[&f](Block *block, size_t)
+				{
+					for (size_t w = 0; w < block->words(); w++)
+						for (uint64_t bits = block->occupied[w]; bits != 0; bits &= bits - 1)
+							f(block->data[w * Block::word_bits + std::countr_zero(bits)]);
+				});
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+template< typename U, typename Reduce, typename Transform >
+U BucketStorage< T, Allocator, Capacity, InlineCapacity >::parallel_reduce(U init, Reduce reduce, Transform transform, size_t threads) const
+{
+	if (threads == 0)
+		threads = std::max< size_t >(1, std::thread::hardware_concurrency());
+	std::vector< size_t > bounds = partition(threads * 4);
+	std::vector< std::optional< U > > partial(bounds.size() - 1);
+	runParallel(bounds,
+				threads,
+				[&](Block *block, size_t chunk)
+				{
+					std::optional< U > &acc = partial[chunk];
+					for (size_t w = 0; w < block->words(); w++)
+						for (uint64_t bits = block->occupied[w]; bits != 0; bits &= bits - 1)
+						{
+							const T &value = block->data[w * Block::word_bits + std::countr_zero(bits)];
+							if (acc)
+								acc = reduce(std::move(*acc), std::invoke(transform, value));
+							else
+								acc.emplace(std::invoke(transform, value));
+						}
+				});
+	for (std::optional< U > &value : partial)
+		if (value)
+			init = reduce(std::move(init), std::move(*value));
+	return init;
+}
+
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+void BucketStorage< T, Allocator, Capacity, InlineCapacity >::save(const char *path) const
+	requires std::is_trivially_copyable_v< T >
+{
+	auto align = [](size_t offset, size_t alignment) { return (offset + alignment - 1) / alignment * alignment; };
+	std::vector< uint64_t > table;
+	table.reserve(3 * n);
+	size_t offset = align(sizeof(Snapshot) + sizeof(uint64_t) * 3 * n, snapshot_page);
+	for (Block *block = head; block != nullptr; block = block->fwd)
+	{
+		table.push_back(offset);
+		table.push_back(block->capacity);
+		table.push_back(block->block_number);
+		offset = align(offset + Block::bytes(block->capacity), Block::alignment());
+	}
+	Snapshot snapshot{};
+	std::memcpy(snapshot.magic, snapshot_magic, sizeof(snapshot.magic));
+	snapshot.version = snapshot_version;
+	snapshot.header_size = sizeof(Block);
+	snapshot.value_size = sizeof(T);
+	snapshot.value_alignment = alignof(T);
+	snapshot.fixed_capacity = Capacity;
+	snapshot.block_capacity = block_capacity;
+	snapshot.blocks = n;
+	snapshot.elements = elements;
+	snapshot.generation = generation;
+	snapshot.length = align(offset, snapshot_page);
+
+	std::unique_ptr< std::FILE, int (*)(std::FILE *) > file(std::fopen(path, "wb"), &std::fclose);
+	if (file == nullptr)
+		throw std::system_error(errno, std::generic_category(), path);
+	size_t written = 0;
+	auto put = [&](const void *bytes, size_t count)
+	{
+		if (count != 0 && std::fwrite(bytes, 1, count, file.get()) != count)
+			throw std::system_error(errno, std::generic_category(), path);
+		written += count;
+	};
+	auto pad = [&](size_t until)
+	{
+		static constexpr unsigned char zeros[snapshot_page] = {};
+		while (written < until)
+			put(zeros, std::min(sizeof(zeros), until - written));
+	};
+	put(&snapshot, sizeof(snapshot));
+	put(table.data(), sizeof(uint64_t) * table.size());
+	size_t k = 0;
+	for (Block *block = head; block != nullptr; block = block->fwd, k += 3)
+	{
+		pad(table[k]);
+		put(block, Block::dataOffset(block->capacity));
+		size_t data = written;
+		for (size_t i = block->first(); i != block->capacity;)
+		{
+			size_t end = block->runEnd(i);
+			pad(data + sizeof(T) * i);
+			put(block->data + i, sizeof(T) * (end - i));
+			i = block->seek(end);
+		}
+		pad(data + sizeof(T) * block->capacity);
+	}
+	pad(snapshot.length);
+	if (std::fclose(file.release()) != 0)
+		throw std::system_error(errno, std::generic_category(), path);
+}
+#if __has_include(<sys/mman.h>)
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+BucketStorage< T, Allocator, Capacity, InlineCapacity > BucketStorage< T, Allocator, Capacity, InlineCapacity >::map(const char *path, const Allocator &alloc)
+	requires std::is_trivially_copyable_v< T >
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		throw std::system_error(errno, std::generic_category(), path);
+	struct stat info;
+	if (fstat(fd, &info) != 0 || static_cast< size_t >(info.st_size) < sizeof(Snapshot))
+	{
+		int error = errno != 0 ? errno : EINVAL;
+		close(fd);
+		throw std::system_error(error, std::generic_category(), path);
+	}
+	size_t length = info.st_size;
+	void *base = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	int error = errno;
+	close(fd);
+	if (base == MAP_FAILED)
+		throw std::system_error(error, std::generic_category(), path);
+
+	unsigned char *bytes = static_cast< unsigned char * >(base);
+	Snapshot *snapshot = static_cast< Snapshot * >(base);
+	const uint64_t *table = reinterpret_cast< const uint64_t * >(snapshot + 1);
+	bool valid = std::memcmp(snapshot->magic, snapshot_magic, sizeof(snapshot->magic)) == 0 &&
+				 snapshot->version == snapshot_version && snapshot->header_size == sizeof(Block) &&
+				 snapshot->value_size == sizeof(T) && snapshot->value_alignment == alignof(T) &&
+				 snapshot->fixed_capacity == Capacity && snapshot->length == length &&
+				 snapshot->blocks <= (length - sizeof(Snapshot)) / (3 * sizeof(uint64_t));
+	for (size_t k = 0; valid && k < snapshot->blocks; k++)
+		valid = table[3 * k] % Block::alignment() == 0 && (Capacity == 0 || table[3 * k + 1] == Capacity) &&
+				table[3 * k + 1] != 0 && table[3 * k] < length && Block::bytes(table[3 * k + 1]) <= length - table[3 * k] &&
+				(k == 0 || table[3 * k + 2] > table[3 * k - 1]) && table[3 * k + 2] < length;
+	if (!valid)
+	{
+		munmap(base, length);
+		throw std::system_error(std::make_error_code(std::errc::invalid_argument), path);
+	}
+
+	BucketStorage storage(snapshot->block_capacity, 1, alloc);
+	storage.generation = snapshot->generation;
+	snapshot->live = 0;
+	try
+	{
+		size_t blocks = snapshot->blocks == 0 ? 0 : table[3 * snapshot->blocks - 1] + 1;
+		storage.ensureTables();
+		storage.tables->directory.reserve(blocks);
+		storage.tables->fenwick.reserve(blocks);
+		for (size_t k = 0; k < snapshot->blocks; k++)
+		{
+			size_t index = table[3 * k + 2];
+			while (storage.indexed() < index)
+				storage.indexBlock(nullptr);
+			Block *block = Block::revive(bytes + table[3 * k], table[3 * k + 1], index, snapshot);
+			snapshot->live++;
+			storage.indexBlock(block);
+			storage.append(block);
+			storage.addRank(index, block->size);
+			storage.elements += block->size;
+			if (block->size != block->capacity)
+				storage.pushVacant(block);
+			storage.tables->addresses.emplace(block->data, block);
+		}
+		storage.rebuildHoles();
+	} catch (...)
+	{
+		if (snapshot->live == 0)
+			munmap(base, length);
+		throw;
+	}
+	if (snapshot->live == 0)
+		munmap(base, length);
+	return storage;
+}
+#endif
+
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+void BucketStorage< T, Allocator, Capacity, InlineCapacity >::swap(BucketStorage &other) noexcept(nothrow_relocate)
+{
+	if (&other == this)
+		return;
+	if constexpr (InlineCapacity != 0)
+	{
+		BucketStorage tmp(std::move(other));
+		other = std::move(*this);
+		*this = std::move(tmp);
+		return;
+	}
+	Block *tmp_first = other.head;
+	Block *tmp_last = other.tail;
+	Tables *tmp_tables = other.tables;
+	uint8_t tmp_vacant_mask = other.vacant_mask;
+	slot_reuse tmp_policy = other.policy;
+	size_t tmp_size = other.elements;
+	size_t tmp_blocks = other.n;
+	size_t tmp_capacity = other.block_capacity;
+	size_t tmp_growth_limit = other.growth_limit;
+	size_t tmp_slots = other.slots;
+	size_t tmp_max_pooled = other.max_pooled;
+	bool tmp_huge = other.use_huge_pages;
+	uint64_t tmp_generation = other.generation;
+	other.head = head;
+	other.tail = tail;
+	other.tables = tables;
+	other.vacant_mask = vacant_mask;
+	other.policy = policy;
+	other.elements = elements;
+	other.n = n;
+	other.block_capacity = block_capacity;
+	other.growth_limit = growth_limit;
+	other.slots = slots;
+	other.max_pooled = max_pooled;
+	other.use_huge_pages = use_huge_pages;
+	other.generation = generation;
+	head = tmp_first;
+	tail = tmp_last;
+	tables = tmp_tables;
+	vacant_mask = tmp_vacant_mask;
+	policy = tmp_policy;
+	elements = tmp_size;
+	n = tmp_blocks;
+	block_capacity = tmp_capacity;
+	growth_limit = tmp_growth_limit;
+	slots = tmp_slots;
+	max_pooled = tmp_max_pooled;
+	use_huge_pages = tmp_huge;
+	generation = tmp_generation;
+	if constexpr (alloc_traits::propagate_on_container_swap::value)
+	{
+		using std::swap;
+		swap(alloc, other.alloc);
+	}
+}
+
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+void BucketStorage< T, Allocator, Capacity, InlineCapacity >::splice(BucketStorage &&other)
+{
+	if (&other == this || other.head == nullptr)
+		return;
+	if (alloc != other.alloc)
+	{
+		moveFrom(other);
+		return;
+	}
+	if constexpr (InlineCapacity != 0)
+		if (!other.local_free)
+		{
+			Block *source = other.local;
+			for (size_t i = source->first(); i != source->capacity; i = source->next(i))
+				emplace(std::move(source->data[i]));
+			other.elements -= source->size;
+			other.popVacant(source);
+			other.unlink(source);
+			other.release(source);
+			if (other.head == nullptr)
+				return;
+		}
+	ensureTables();
+	tables->directory.reserve(std::max(indexed(), n) + other.n);
+	tables->fenwick.reserve(std::max(indexed(), n) + other.n);
+	indexLocal();
+	for (Block *block = other.head; block != nullptr; block = block->fwd)
+	{
+		size_t index = indexed();
+		block->block_number = index;
+		indexBlock(block);
+		addRank(index, block->size);
+		tables->addresses.insert(other.tables->addresses.extract(block->data));
+		block->stamp_base += generation;
+		if (block->size != block->capacity)
+			pushVacant(block);
+	}
+	other.head->bwd = tail;
+	if (tail == nullptr)
+		head = other.head;
+	else
+		tail->fwd = other.head;
+	tail = other.tail;
+	n += std::exchange(other.n, 0);
+	elements += std::exchange(other.elements, 0);
+	slots += std::exchange(other.slots, 0);
+	generation += other.generation;
+	other.head = nullptr;
+	other.tail = nullptr;
+	other.vacant_mask = 0;
+	other.tables->directory.clear();
+	other.tables->fenwick.clear();
+	other.tables->holes.clear();
+	other.tables->vacant = {};
+}
+
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+void BucketStorage< T, Allocator, Capacity, InlineCapacity >::shrink_to_fit()
+{
+	compact_step(std::numeric_limits< size_t >::max());
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+bool BucketStorage< T, Allocator, Capacity, InlineCapacity >::compact_step(size_t budget)
+{
+	return compact_step(budget, [](const handle &, const handle &) {});
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+template< typename Relocate >
+bool BucketStorage< T, Allocator, Capacity, InlineCapacity >::compact_step(size_t budget, Relocate relocate)
+{
+	while (budget != 0 && tail != nullptr && slots - elements >= tail->capacity)
+	{
+		Block *source = tail;
+		Block *target = nullptr;
+		size_t moved = 0;
+		auto commit = [&]
+		{
+			if (moved == 0)
+				return;
+			addRank(target->block_number, static_cast< difference_type >(moved));
+			addRank(source->block_number, -static_cast< difference_type >(moved));
+			moved = 0;
+		};
+		auto finish = [&]
+		{
+			commit();
+			if (target != nullptr)
+				updateVacant(target);
+			if (source->size == 0)
+			{
+				unlink(source);
+				release(source);
+			}
+			else if (source->size != source->capacity)
+				pushVacant(source);
+		};
+		popVacant(source);
+		target = firstVacant();
+		try
+		{
+			for (size_t i = source->last(); budget != 0 && source->size != 0 && target != nullptr; i = source->previous(i), budget--)
+			{
+				size_t j = target->vacantSlot();
+				alloc_traits::construct(alloc, target->data + j, std::move(source->data[i]));
+				target->occupy(j);
+				target->setStamp(j, generation++);
+				handle from{ source->block_number, i, source->stamp(i) };
+				handle to{ target->block_number, j, target->stamp(j) };
+				source->erase(i, alloc);
+				moved++;
+				if (target->size == target->capacity)
+				{
+					commit();
+					popVacant(target);
+					target = firstVacant();
+				}
+				relocate(from, to);
+			}
+		} catch (...)
+		{
+			finish();
+			throw;
+		}
+		finish();
+	}
+	return tail != nullptr && slots - elements >= tail->capacity;
+}
+
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+BucketStorage< T, Allocator, Capacity, InlineCapacity > &BucketStorage< T, Allocator, Capacity, InlineCapacity >::operator=(const BucketStorage< T, Allocator, Capacity, InlineCapacity > &other)
+{
+	if (this == &other)
+		return *this;
+
+	clear();
+	if (block_capacity != other.block_capacity)
+		trimPool(0);
+	block_capacity = other.block_capacity;
+	growth_limit = other.growth_limit;
+	policy = other.policy;
+	if constexpr (alloc_traits::propagate_on_container_copy_assignment::value)
+	{
+		if (alloc != other.alloc)
+		{
+			trimPool(0);
+			dropTables();
+		}
+		alloc = other.alloc;
+	}
+	copyFrom(other);
+	return *this;
+}
+
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+BucketStorage< T, Allocator, Capacity, InlineCapacity > &BucketStorage< T, Allocator, Capacity, InlineCapacity >::operator=(BucketStorage< T, Allocator, Capacity, InlineCapacity > &&other) noexcept(
+	(alloc_traits::propagate_on_container_move_assignment::value || alloc_traits::is_always_equal::value) &&
+	nothrow_relocate)
+{
+	if (this == &other)
+		return *this;
+	clear();
+	if constexpr (alloc_traits::propagate_on_container_move_assignment::value)
+	{
+		trimPool(0);
+		dropTables();
+		alloc = std::move(other.alloc);
+		adopt(other);
+	}
+	else if (alloc == other.alloc)
+	{
+		trimPool(0);
+		dropTables();
+		adopt(other);
+	}
+	else
+	{
+		if (block_capacity != other.block_capacity)
+			trimPool(0);
+		block_capacity = other.block_capacity;
+		growth_limit = other.growth_limit;
+		policy = other.policy;
+		moveFrom(other);
+	}
+	return *this;
+}
+
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+BucketStorage< T, Allocator, Capacity, InlineCapacity >::~BucketStorage()
+{
+	clear();
+	trimPool(0);
+	dropTables();
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+typename BucketStorage< T, Allocator, Capacity, InlineCapacity >::Block *BucketStorage< T, Allocator, Capacity, InlineCapacity >::Block::create(size_t capacity, size_t block_number, bool huge, Allocator &alloc)
+{
+	size_t size = bytes(capacity);
+	huge = huge && size >= huge_page;
+	if (!huge)
+		return new (allocateUnits< line >(alloc, (size + sizeof(line) - 1) / sizeof(line))) Block(capacity, block_number, false);
+	size_t pages = (size + huge_page - 1) / huge_page;
+	void *memory = allocateUnits< page >(alloc, pages);
+#if defined(MADV_HUGEPAGE)
+	madvise(memory, pages * huge_page, MADV_HUGEPAGE);
+#endif
+	return new (memory) Block(capacity, block_number, true);
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+typename BucketStorage< T, Allocator, Capacity, InlineCapacity >::Block *BucketStorage< T, Allocator, Capacity, InlineCapacity >::Block::revive(unsigned char *image, size_t capacity, size_t block_number, Snapshot *mapping)
+{
+	std::vector< unsigned char > saved(image, image + dataOffset(capacity));
+	Block *block = new (image) Block(capacity, block_number, false);
+	unsigned char *occupied = reinterpret_cast< unsigned char * >(block->occupied);
+	unsigned char *stamps = reinterpret_cast< unsigned char * >(block->stamps);
+	std::memcpy(occupied, saved.data() + (occupied - image), sizeof(uint64_t) * block->words());
+	std::memcpy(stamps, saved.data() + (stamps - image), sizeof(uint64_t) * capacity);
+	std::memcpy(&block->stamp_base, saved.data() + (reinterpret_cast< unsigned char * >(&block->stamp_base) - image), sizeof(uint64_t));
+	for (size_t w = 0; w < block->words(); w++)
+		block->size += std::popcount(block->occupied[w]);
+	block->mapping = mapping;
+	return block;
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+void BucketStorage< T, Allocator, Capacity, InlineCapacity >::Block::destroy(Block *block, Allocator &alloc) noexcept
+{
+	size_t size = bytes(block->capacity);
+	bool huge = block->huge;
+	Snapshot *mapping = block->mapping;
+	block->destroyElements(alloc);
+	block->~Block();
+	if (mapping != nullptr)
+	{
+#if __has_include(<sys/mman.h>)
+		if (--mapping->live == 0)
+			munmap(mapping, mapping->length);
+#endif
+	}
+	else if (huge)
+		deallocateUnits< page >(alloc, block, (size + huge_page - 1) / huge_page);
+	else
+		deallocateUnits< line >(alloc, block, (size + sizeof(line) - 1) / sizeof(line));
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+template< typename Unit >
+void *BucketStorage< T, Allocator, Capacity, InlineCapacity >::Block::allocateUnits(Allocator &alloc, size_t count)
+{
+	typename alloc_traits::template rebind_alloc< Unit > units(alloc);
+	return std::to_address(alloc_traits::template rebind_traits< Unit >::allocate(units, count));
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+template< typename Unit >
+void BucketStorage< T, Allocator, Capacity, InlineCapacity >::Block::deallocateUnits(Allocator &alloc, void *memory, size_t count) noexcept
+{
+	using unit_traits = typename alloc_traits::template rebind_traits< Unit >;
+	typename alloc_traits::template rebind_alloc< Unit > units(alloc);
+	unit_traits::deallocate(units, std::pointer_traits< typename unit_traits::pointer >::pointer_to(*static_cast< Unit * >(memory)), count);
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+constexpr size_t BucketStorage< T, Allocator, Capacity, InlineCapacity >::Block::alignment() noexcept
+{
+	return alignof(line);
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+constexpr size_t BucketStorage< T, Allocator, Capacity, InlineCapacity >::Block::dataOffset(size_t capacity) noexcept
+{
+	size_t header_end = sizeof(Block) + BlockSlots< Capacity >::trailing(capacity);
+	return (header_end + alignment() - 1) / alignment() * alignment();
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+constexpr size_t BucketStorage< T, Allocator, Capacity, InlineCapacity >::Block::bytes(size_t capacity) noexcept
+{
+	return dataOffset(capacity) + sizeof(T) * capacity;
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+BucketStorage< T, Allocator, Capacity, InlineCapacity >::Block::Block(size_t capacity, size_t block_number, bool huge) :
+	BlockSlots< Capacity >(capacity, reinterpret_cast< uint64_t * >(this + 1)),
+	data(reinterpret_cast< T * >(reinterpret_cast< char * >(this) + dataOffset(capacity))), fwd(nullptr), bwd(nullptr),
+	size(0), block_number(block_number), prev_vacant(nullptr), next_vacant(nullptr), vacant_level(0), huge(huge), mapping(nullptr),
+	stamp_base(0)
+{
+	std::memset(occupied, 0, sizeof(uint64_t) * words());
+#ifdef BUCKET_STORAGE_STATS
+	std::fill_n(stamps, capacity, unused_stamp);
+#endif
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+uint64_t BucketStorage< T, Allocator, Capacity, InlineCapacity >::Block::stamp(size_t i) const
+{
+	return stamps[i] + stamp_base;
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+void BucketStorage< T, Allocator, Capacity, InlineCapacity >::Block::setStamp(size_t i, uint64_t generation)
+{
+	stamps[i] = generation - stamp_base;
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+size_t BucketStorage< T, Allocator, Capacity, InlineCapacity >::Block::vacantSlot() const
+{
+	size_t w = 0;
+	while (occupied[w] == ~uint64_t(0))
+		w++;
+	return w * word_bits + std::countr_one(occupied[w]);
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+size_t BucketStorage< T, Allocator, Capacity, InlineCapacity >::Block::rank(size_t i) const
+{
+	size_t count = 0;
+	for (size_t w = 0; w < i / word_bits; w++)
+		count += std::popcount(occupied[w]);
+	if (i % word_bits != 0)
+		count += std::popcount(occupied[i / word_bits] & ((uint64_t(1) << i % word_bits) - 1));
+	return count;
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+size_t BucketStorage< T, Allocator, Capacity, InlineCapacity >::Block::select(size_t k) const
+{
+	size_t w = 0;
+	while (k >= static_cast< size_t >(std::popcount(occupied[w])))
+		k -= std::popcount(occupied[w++]);
+	uint64_t bits = occupied[w];
+	for (; k != 0; k--)
+		bits &= bits - 1;
+	return w * word_bits + std::countr_zero(bits);
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+void BucketStorage< T, Allocator, Capacity, InlineCapacity >::Block::occupy(size_t i)
+{
+	occupied[i / word_bits] |= uint64_t(1) << (i % word_bits);
+	size++;
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+size_t BucketStorage< T, Allocator, Capacity, InlineCapacity >::Block::erase(size_t i, Allocator &alloc)
+{
+	alloc_traits::destroy(alloc, data + i);
+	occupied[i / word_bits] &= ~(uint64_t(1) << (i % word_bits));
+	size--;
+	return next(i);
+}
+
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+void BucketStorage< T, Allocator, Capacity, InlineCapacity >::Block::clear(Allocator &alloc) noexcept
+{
+	destroyElements(alloc);
+	std::memset(occupied, 0, sizeof(uint64_t) * words());
+	size = 0;
+}
+
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+void BucketStorage< T, Allocator, Capacity, InlineCapacity >::Block::destroyElements(Allocator &alloc) noexcept
+{
+	if constexpr (!std::is_trivially_destructible_v< T >)
+		for (size_t w = 0; w < words(); w++)
+			for (uint64_t bits = occupied[w]; bits != 0; bits &= bits - 1)
+				alloc_traits::destroy(alloc, data + w * word_bits + std::countr_zero(bits));
+}
+
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+size_t BucketStorage< T, Allocator, Capacity, InlineCapacity >::Block::words() const
+{
+	return (capacity + word_bits - 1) / word_bits;
+}
+
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+size_t BucketStorage< T, Allocator, Capacity, InlineCapacity >::Block::first() const
+{
+	for (size_t w = 0; w < words(); w++)
+		if (occupied[w] != 0)
+			return w * word_bits + std::countr_zero(occupied[w]);
+	return capacity;
+}
+
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+size_t BucketStorage< T, Allocator, Capacity, InlineCapacity >::Block::last() const
+{
+	for (size_t w = words(); w-- > 0;)
+		if (occupied[w] != 0)
+			return w * word_bits + word_bits - 1 - std::countl_zero(occupied[w]);
+	return capacity;
+}
+
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+size_t BucketStorage< T, Allocator, Capacity, InlineCapacity >::Block::seek(size_t from) const
+{
+	if (from >= capacity)
+		return capacity;
+	size_t w = from / word_bits;
+	uint64_t bits = occupied[w] & (~uint64_t(0) << (from % word_bits));
+	while (bits == 0)
+	{
+		if (++w == words())
+			return capacity;
+		bits = occupied[w];
+	}
+	return w * word_bits + std::countr_zero(bits);
+}
+
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+size_t BucketStorage< T, Allocator, Capacity, InlineCapacity >::Block::runEnd(size_t from) const
+{
+	size_t w = from / word_bits;
+	uint64_t bits = ~occupied[w] & (~uint64_t(0) << (from % word_bits));
+	while (bits == 0)
+	{
+		if (++w == words())
+			return capacity;
+		bits = ~occupied[w];
+	}
+	return std::min(capacity, w * word_bits + std::countr_zero(bits));
+}
+
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+size_t BucketStorage< T, Allocator, Capacity, InlineCapacity >::Block::next(size_t current) const
+{
+	return seek(current + 1);
+}
+
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+size_t BucketStorage< T, Allocator, Capacity, InlineCapacity >::Block::previous(size_t current) const
+{
+	if (current == 0)
+		return capacity;
+	current--;
+	size_t w = current / word_bits;
+	uint64_t bits = occupied[w] & (~uint64_t(0) >> (word_bits - 1 - current % word_bits));
+	while (bits == 0)
+	{
+		if (w == 0)
+			return capacity;
+		bits = occupied[--w];
+	}
+	return w * word_bits + word_bits - 1 - std::countl_zero(bits);
+}
+
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+bool BucketStorage< T, Allocator, Capacity, InlineCapacity >::Block::isActive(size_t i) const
+{
+	return i < capacity && (occupied[i / word_bits] >> (i % word_bits) & 1) != 0;
+}
+
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+typename BucketStorage< T, Allocator, Capacity, InlineCapacity >::iterator BucketStorage< T, Allocator, Capacity, InlineCapacity >::bucket::begin() const noexcept
+{
+	if (block == nullptr)
+		return iterator(0, nullptr);
+	return iterator(block->first(), block);
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+typename BucketStorage< T, Allocator, Capacity, InlineCapacity >::iterator BucketStorage< T, Allocator, Capacity, InlineCapacity >::bucket::end() const noexcept
+{
+	if (block == nullptr)
+		return iterator(0, nullptr);
+	if (block->fwd == nullptr)
+		return iterator(block->capacity, block);
+	return iterator(block->fwd->first(), block->fwd);
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+typename BucketStorage< T, Allocator, Capacity, InlineCapacity >::const_iterator BucketStorage< T, Allocator, Capacity, InlineCapacity >::bucket::cbegin() const noexcept
+{
+	return begin();
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+typename BucketStorage< T, Allocator, Capacity, InlineCapacity >::const_iterator BucketStorage< T, Allocator, Capacity, InlineCapacity >::bucket::cend() const noexcept
+{
+	return end();
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+typename BucketStorage< T, Allocator, Capacity, InlineCapacity >::size_type BucketStorage< T, Allocator, Capacity, InlineCapacity >::bucket::size() const noexcept
+{
+	return block == nullptr ? 0 : block->size;
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+bool BucketStorage< T, Allocator, Capacity, InlineCapacity >::bucket::empty() const noexcept
+{
+	return size() == 0;
+}
+
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+template< typename V >
+BucketStorage< T, Allocator, Capacity, InlineCapacity >::segment_iterator< V >::segment_iterator(Block *block, size_t position) :
+	block(block), position(position)
+{
+	settle();
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+template< typename V >
+void BucketStorage< T, Allocator, Capacity, InlineCapacity >::segment_iterator< V >::settle()
+{
+	for (; block != nullptr; block = block->fwd, position = 0)
+	{
+		position = block->seek(position);
+		if (position != block->capacity)
+		{
+			run = std::span< V >(block->data + position, block->runEnd(position) - position);
+			return;
+		}
+	}
+	position = 0;
+	run = {};
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+template< typename V >
+typename BucketStorage< T, Allocator, Capacity, InlineCapacity >::template segment_iterator< V > &BucketStorage< T, Allocator, Capacity, InlineCapacity >::segment_iterator< V >::operator++()
+{
+	position += run.size();
+	settle();
+	return *this;
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+template< typename V >
+typename BucketStorage< T, Allocator, Capacity, InlineCapacity >::template segment_iterator< V > BucketStorage< T, Allocator, Capacity, InlineCapacity >::segment_iterator< V >::operator++(int)
+{
+	segment_iterator tmp = *this;
+	++(*this);
+	return tmp;
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+template< typename V >
+typename BucketStorage< T, Allocator, Capacity, InlineCapacity >::template segment_iterator< V >::reference BucketStorage< T, Allocator, Capacity, InlineCapacity >::segment_iterator< V >::operator*() const
+{
+	return run;
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+template< typename V >
+typename BucketStorage< T, Allocator, Capacity, InlineCapacity >::template segment_iterator< V >::pointer BucketStorage< T, Allocator, Capacity, InlineCapacity >::segment_iterator< V >::operator->() const
+{
+	return &run;
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+template< typename V >
+bool BucketStorage< T, Allocator, Capacity, InlineCapacity >::segment_iterator< V >::operator==(const segment_iterator &a) const
+{
+	return block == a.block && position == a.position;
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+template< typename V >
+BucketStorage< T, Allocator, Capacity, InlineCapacity >::segment_range< V >::segment_range(Block *head) : head(head)
+{
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+template< typename V >
+typename BucketStorage< T, Allocator, Capacity, InlineCapacity >::template segment_iterator< V > BucketStorage< T, Allocator, Capacity, InlineCapacity >::segment_range< V >::begin() const
+{
+	return segment_iterator< V >(head, 0);
+}
+template< typename T, typename Allocator, size_t Capacity, size_t InlineCapacity >
+template< typename V >
+typename BucketStorage< T, Allocator, Capacity, InlineCapacity >::template segment_iterator< V > BucketStorage< T, Allocator, Capacity, InlineCapacity >::segment_range< V >::end() const
+{
+	return segment_iterator< V >();
+}
+
+template< typename Storage >
+iterator< Storage >::iterator(size_t i, typename Storage::Block *current) : block(current), i(i)
+{
+}
+
+template< typename Storage >
+iterator< Storage >::iterator(const const_iterator< Storage > &other) : iterator(other.i, other.block)
+{
+}
+
+template< typename Storage >
+iterator< Storage > &iterator< Storage >::operator++()
+{
+	i = block->next(i);
+	if (i == block->capacity && block->fwd != nullptr)
+	{
+		block = block->fwd;
+		i = block->first();
+	}
+	return *this;
+}
+template< typename Storage >
+iterator< Storage > iterator< Storage >::operator++(int)
+{
+	iterator< Storage > tmp = *this;
+	++(*this);
+	return tmp;
+}
+template< typename Storage >
+iterator< Storage > &iterator< Storage >::operator--()
+{
+	size_t prev = block->previous(i);
+	if (prev == block->capacity)
+	{
+		if (block->bwd != nullptr)
+		{
+			block = block->bwd;
+			i = block->last();
+		}
+	}
+	else
+	{
+		i = prev;
+	}
+	return *this;
+}
+template< typename Storage >
+iterator< Storage > iterator< Storage >::operator--(int)
+{
+	iterator< Storage > tmp = *this;
+	--(*this);
+	return tmp;
+}
+template< typename Storage >
+typename iterator< Storage >::reference iterator< Storage >::operator*() const
+{
+	return block->data[i];
+}
+template< typename Storage >
+typename iterator< Storage >::pointer iterator< Storage >::operator->() const
+{
+	return &block->data[i];
+}
+
+template< typename Storage >
+bool iterator< Storage >::operator==(const iterator< Storage > &a) const
+{
+	return block == a.block && i == a.i;
+}
+
+template< typename Storage >
+bool iterator< Storage >::operator==(const const_iterator< Storage > &a) const
+{
+	return block == a.block && i == a.i;
+}
+template< typename Storage >
+bool iterator< Storage >::operator<(const iterator< Storage > &a) const
+{
+	return block->block_number < a.block->block_number || block == a.block && i < a.i;
+}
+template< typename Storage >
+bool iterator< Storage >::operator<=(const iterator< Storage > &a) const
+{
+	return *this < a || *this == a;
+}
+template< typename Storage >
+bool iterator< Storage >::operator>(const iterator< Storage > &a) const
+{
+	return a < *this;
+}
+template< typename Storage >
+bool iterator< Storage >::operator>=(const iterator< Storage > &a) const
+{
+	return *this > a || *this == a;
+}
+
+template< typename Storage >
+iterator< Storage > &iterator< Storage >::operator=(iterator< Storage > a)
+{
+	block = a.block;
+	i = a.i;
+	return *this;
+}
+template< typename Storage >
+const_iterator< Storage >::const_iterator(size_t i, typename Storage::Block *current) : block(current), i(i)
+{
+}
+
+template< typename Storage >
+const_iterator< Storage >::const_iterator(const iterator< Storage > &other) : const_iterator(other.i, other.block)
+{
+}
+
+template< typename Storage >
+const_iterator< Storage > &const_iterator< Storage >::operator++()
+{
+	i = block->next(i);
+	if (i == block->capacity && block->fwd != nullptr)
+	{
+		block = block->fwd;
+		i = block->first();
+	}
+	return *this;
+}
+template< typename Storage >
+const_iterator< Storage > const_iterator< Storage >::operator++(int)
+{
+	const_iterator< Storage > tmp = *this;
+	++(*this);
+	return tmp;
+}
+template< typename Storage >
+const_iterator< Storage > &const_iterator< Storage >::operator--()
+{
+	size_t prev = block->previous(i);
+	if (prev == block->capacity)
+	{
+		if (block->bwd != nullptr)
+		{
+			block = block->bwd;
+			i = block->last();
+		}
+	}
+	else
+	{
+		i = prev;
+	}
+	return *this;
+}
+template< typename Storage >
+const_iterator< Storage > const_iterator< Storage >::operator--(int)
+{
+	const_iterator< Storage > tmp = *this;
+	--(*this);
+	return tmp;
+}
+template< typename Storage >
+typename const_iterator< Storage >::reference const_iterator< Storage >::operator*() const
+{
+	return block->data[i];
+}
+template< typename Storage >
+typename const_iterator< Storage >::pointer const_iterator< Storage >::operator->() const
+{
+	return &block->data[i];
+}
+
+template< typename Storage >
+bool const_iterator< Storage >::operator==(const const_iterator< Storage > &a) const
+{
+	return block == a.block && i == a.i;
+}
+
+template< typename Storage >
+bool const_iterator< Storage >::operator<(const const_iterator< Storage > &a) const
+{
+	return block->block_number < a.block->block_number || block == a.block && i < a.i;
+}
+template< typename Storage >
+bool const_iterator< Storage >::operator<=(const const_iterator< Storage > &a) const
+{
+	return *this < a || *this == a;
+}
+template< typename Storage >
+bool const_iterator< Storage >::operator>(const const_iterator< Storage > &a) const
+{
+	return a < *this;
+}
+
+template< typename Storage >
+bool const_iterator< Storage >::operator>=(const const_iterator< Storage > &a) const
+{
+	return *this > a || *this == a;
+}
+
+template< typename Storage >
+const_iterator< Storage > &const_iterator< Storage >::operator=(const_iterator< Storage > a)
+{
+	block = a.block;
+	i = a.i;
+	return *this;
+}
+
+#endif
@@ -0,0 +1,283 @@
+#ifndef CONCURRENT_BUCKET_STORAGE
+#define CONCURRENT_BUCKET_STORAGE
+
+#include "bucket_storage.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+
+template< typename T, typename Allocator = std::allocator< T > >
+class ConcurrentBucketStorage
+{
+  public:
+	using value_type = T;
+	using allocator_type = Allocator;
+	using size_type = size_t;
+	using storage_type = BucketStorage< T, Allocator >;
+
+	struct handle
+	{
+		size_t shard;
+		typename storage_type::handle local;
+
+		bool operator==(const handle &other) const = default;
+	};
+
+  public:
+	explicit ConcurrentBucketStorage(size_t count = 0, size_t block_capacity = 64, const Allocator &alloc = Allocator());
+	ConcurrentBucketStorage(const ConcurrentBucketStorage &other) = delete;
+	ConcurrentBucketStorage &operator=(const ConcurrentBucketStorage &other) = delete;
+
+	handle insert(const T &value);
+	handle insert(T &&value);
+	template< typename... Args >
+	handle emplace(Args &&...args);
+
+	bool erase(handle h);
+	bool erase(const T *element);
+
+	// visit() and for_each() call f with shard locks held, so f must not insert into or erase from this storage.
+	template< typename F >
+	bool visit(handle h, F f);
+	template< typename F >
+	void for_each(F f);
+	template< typename F >
+	void for_each(F f) const;
+
+	size_type size() const;
+	bool empty() const;
+	size_t shard_count() const noexcept;
+	void clear();
+	storage_type collect();
+
+  private:
+	struct alignas(64) Shard
+	{
+		explicit Shard(size_t block_capacity, const Allocator &alloc);
+
+		mutable std::mutex mutex;
+		storage_type storage;
+	};
+
+	struct Owner
+	{
+		const T *end;
+		size_t shard;
+	};
+
+	using owner_allocator = typename std::allocator_traits< Allocator >::template rebind_alloc< std::pair< const T *const, Owner > >;
+
+	static size_t threadSlot() noexcept;
+	size_t ownShard() const noexcept;
+	std::vector< std::unique_lock< std::mutex > > lockAll() const;
+	void eraseLocked(Shard &shard, typename storage_type::iterator it);
+
+	std::vector< std::unique_ptr< Shard > > shards;
+	mutable std::shared_mutex owners_mutex;
+	std::map< const T *, Owner, std::less<>, owner_allocator > owners;
+};
+
+template< typename T, typename Allocator >
+ConcurrentBucketStorage< T, Allocator >::Shard::Shard(const size_t block_capacity, const Allocator &alloc) :
+	storage(block_capacity, 1, alloc)
+{
+}
+
+template< typename T, typename Allocator >
+ConcurrentBucketStorage< T, Allocator >::ConcurrentBucketStorage(size_t count, const size_t block_capacity, const Allocator &alloc) :
+	owners(owner_allocator(alloc))
+{
+	if (count == 0)
+		count = std::max< size_t >(1, std::thread::hardware_concurrency());
+	shards.reserve(count);
+	for (size_t i = 0; i < count; i++)
+		shards.push_back(std::make_unique< Shard >(block_capacity, alloc));
+}
+
+template< typename T, typename Allocator >
+typename ConcurrentBucketStorage< T, Allocator >::handle ConcurrentBucketStorage< T, Allocator >::insert(const T &value)
+{
+	return emplace(value);
+}
+template< typename T, typename Allocator >
+typename ConcurrentBucketStorage< T, Allocator >::handle ConcurrentBucketStorage< T, Allocator >::insert(T &&value)
+{
+	return emplace(std::move(value));
+}
+template< typename T, typename Allocator >
+template< typename... Args >
+typename ConcurrentBucketStorage< T, Allocator >::handle ConcurrentBucketStorage< T, Allocator >::emplace(Args &&...args)
+{
+	size_t index = ownShard();
+	Shard &shard = *shards[index];
+	std::lock_guard< std::mutex > lock(shard.mutex);
+	size_t before = shard.storage.capacity();
+	typename storage_type::iterator it = shard.storage.emplace(std::forward< Args >(args)...);
+	handle h{ index, shard.storage.handle_of(it) };
+	if (shard.storage.capacity() != before)
+	{
+		const T *first = &*it - h.local.slot;
+		try
+		{
+			std::lock_guard< std::shared_mutex > owners_lock(owners_mutex);
+			owners.emplace(first, Owner{ first + (shard.storage.capacity() - before), index });
+		} catch (...)
+		{
+			shard.storage.erase(it);
+			throw;
+		}
+	}
+	return h;
+}
+
+template< typename T, typename Allocator >
+bool ConcurrentBucketStorage< T, Allocator >::erase(handle h)
+{
+	if (h.shard >= shards.size())
+		return false;
+	Shard &shard = *shards[h.shard];
+	std::lock_guard< std::mutex > lock(shard.mutex);
+	const T *element = shard.storage.get(h.local);
+	if (element == nullptr)
+		return false;
+	eraseLocked(shard, shard.storage.iterator_to(element));
+	return true;
+}
+template< typename T, typename Allocator >
+bool ConcurrentBucketStorage< T, Allocator >::erase(const T *element)
+{
+	size_t index;
+	{
+		std::shared_lock< std::shared_mutex > owners_lock(owners_mutex);
+		auto owner = owners.upper_bound(element);
+		if (owner == owners.begin())
+			return false;
+		--owner;
+		if (std::greater_equal<>()(element, owner->second.end))
+			return false;
+		index = owner->second.shard;
+	}
+	Shard &shard = *shards[index];
+	std::lock_guard< std::mutex > lock(shard.mutex);
+	typename storage_type::iterator it = shard.storage.iterator_to(element);
+	if (it == shard.storage.end())
+		return false;
+	eraseLocked(shard, it);
+	return true;
+}
+
+template< typename T, typename Allocator >
+template< typename F >
+bool ConcurrentBucketStorage< T, Allocator >::visit(handle h, F f)
+{
+	if (h.shard >= shards.size())
+		return false;
+	Shard &shard = *shards[h.shard];
+	std::lock_guard< std::mutex > lock(shard.mutex);
+	T *element = shard.storage.get(h.local);
+	if (element == nullptr)
+		return false;
+	f(*element);
+	return true;
+}
+template< typename T, typename Allocator >
+template< typename F >
+void ConcurrentBucketStorage< T, Allocator >::for_each(F f)
+{
+	std::vector< std::unique_lock< std::mutex > > locks = lockAll();
+	for (std::unique_ptr< Shard > &shard : shards)
+		for (T &value : shard->storage)
+			f(value);
+}
+template< typename T, typename Allocator >
+template< typename F >
+void ConcurrentBucketStorage< T, Allocator >::for_each(F f) const
+{
+	std::vector< std::unique_lock< std::mutex > > locks = lockAll();
+	for (const std::unique_ptr< Shard > &shard : shards)
+		for (const T &value : std::as_const(shard->storage))
+			f(value);
+}
+
+template< typename T, typename Allocator >
+typename ConcurrentBucketStorage< T, Allocator >::size_type ConcurrentBucketStorage< T, Allocator >::size() const
+{
+	std::vector< std::unique_lock< std::mutex > > locks = lockAll();
+	size_type total = 0;
+	for (const std::unique_ptr< Shard > &shard : shards)
+		total += shard->storage.size();
+	return total;
+}
+template< typename T, typename Allocator >
+bool ConcurrentBucketStorage< T, Allocator >::empty() const
+{
+	return size() == 0;
+}
+template< typename T, typename Allocator >
+size_t ConcurrentBucketStorage< T, Allocator >::shard_count() const noexcept
+{
+	return shards.size();
+}
+template< typename T, typename Allocator >
+void ConcurrentBucketStorage< T, Allocator >::clear()
+{
+	std::vector< std::unique_lock< std::mutex > > locks = lockAll();
+	for (std::unique_ptr< Shard > &shard : shards)
+		shard->storage.clear();
+	std::lock_guard< std::shared_mutex > owners_lock(owners_mutex);
+	owners.clear();
+}
+template< typename T, typename Allocator >
+typename ConcurrentBucketStorage< T, Allocator >::storage_type ConcurrentBucketStorage< T, Allocator >::collect()
+{
+	std::vector< std::unique_lock< std::mutex > > locks = lockAll();
+	storage_type result(std::move(shards.front()->storage));
+	for (size_t i = 1; i < shards.size(); i++)
+		result.splice(std::move(shards[i]->storage));
+	std::lock_guard< std::shared_mutex > owners_lock(owners_mutex);
+	owners.clear();
+	return result;
+}
+
+template< typename T, typename Allocator >
+void ConcurrentBucketStorage< T, Allocator >::eraseLocked(Shard &shard, typename storage_type::iterator it)
+{
+	size_t before = shard.storage.capacity();
+	const T *first = &*it - shard.storage.handle_of(it).slot;
+	shard.storage.erase(it);
+	if (shard.storage.capacity() == before)
+		return;
+	std::lock_guard< std::shared_mutex > owners_lock(owners_mutex);
+	owners.erase(first);
+}
+
+template< typename T, typename Allocator >
+size_t ConcurrentBucketStorage< T, Allocator >::threadSlot() noexcept
+{
+	static std::atomic< size_t > next(0);
+	thread_local size_t slot = next.fetch_add(1, std::memory_order_relaxed);
+	return slot;
+}
+template< typename T, typename Allocator >
+size_t ConcurrentBucketStorage< T, Allocator >::ownShard() const noexcept
+{
+	return threadSlot() % shards.size();
+}
+template< typename T, typename Allocator >
+std::vector< std::unique_lock< std::mutex > > ConcurrentBucketStorage< T, Allocator >::lockAll() const
+{
+	std::vector< std::unique_lock< std::mutex > > locks;
+	locks.reserve(shards.size());
+	for (const std::unique_ptr< Shard > &shard : shards)
+		locks.emplace_back(shard->mutex);
+	return locks;
+}
+
+#endif
@@ -0,0 +1,947 @@
+#include "bucket_storage.hpp"
+#include "concurrent_bucket_storage.hpp"
+#include "lockfree_bucket_storage.hpp"
+#include "persistent_bucket_storage.hpp"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <numeric>
+#include <span>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+template< typename T >
+struct CountingAllocator
+{
+	using value_type = T;
+
+	explicit CountingAllocator(size_t *count) noexcept : count(count) {}
+	template< typename U >
+	CountingAllocator(const CountingAllocator< U > &other) noexcept : count(other.count)
+	{
+	}
+
+	T *allocate(size_t n)
+	{
+		++*count;
+		return std::allocator< T >().allocate(n);
+	}
+	void deallocate(T *p, size_t n) noexcept { std::allocator< T >().deallocate(p, n); }
+
+	template< typename U >
+	bool operator==(const CountingAllocator< U > &other) const noexcept
+	{
+		return count == other.count;
+	}
+
+	size_t *count;
+};
+
+struct Tracked
+{
+	explicit Tracked(int value) noexcept : value(value) {}
+	Tracked(const Tracked &other) noexcept : value(other.value) { copies++; }
+	~Tracked() { destroyed++; }
+
+	int value;
+	static inline size_t copies = 0;
+	static inline size_t destroyed = 0;
+};
+
+static std::string scratchPath(const char *name)
+{
+	return (std::filesystem::temp_directory_path() / (std::string(name) + "." + std::to_string(getpid()))).string();
+}
+
+TEST(bitmap, iteration_skips_erased)
+{
+	BucketStorage< int > b(8);
+	for (int i = 0; i < 40; ++i)
+		b.insert(i);
+	for (int i = 0; i < 40; i += 3)
+		b.erase(std::find(b.begin(), b.end(), i));
+
+	std::vector< int > forward(b.begin(), b.end());
+	std::vector< int > expected;
+	for (int i = 0; i < 40; ++i)
+		if (i % 3 != 0)
+			expected.push_back(i);
+	ASSERT_EQ(forward, expected);
+
+	std::vector< int > backward;
+	for (auto it = b.end(); it != b.begin();)
+		backward.push_back(*--it);
+	std::reverse(backward.begin(), backward.end());
+	ASSERT_EQ(backward, expected);
+}
+
+TEST(vacancy, insert_reuses_freed_slot_before_growing)
+{
+	BucketStorage< int > b(8);
+	for (int i = 0; i < 32; ++i)
+		b.insert(i);
+	auto hole = std::find(b.begin(), b.end(), 3);
+	const int *address = &*hole;
+	b.erase(hole);
+	size_t capacity = b.capacity();
+
+	auto it = b.insert(100);
+	ASSERT_EQ(&*it, address);
+	ASSERT_EQ(b.capacity(), capacity);
+	b.insert(101);
+	ASSERT_EQ(b.capacity(), capacity + 8);
+}
+
+TEST(pool, reuses_released_blocks)
+{
+	size_t allocations = 0;
+	BucketStorage< int, CountingAllocator< int > > b(8, 2, CountingAllocator< int >(&allocations));
+	for (int i = 0; i < 9; ++i)
+		b.insert(i);
+	b.erase(b.nth(8));
+	size_t before = allocations;
+	for (int i = 0; i < 100; ++i)
+		b.erase(b.insert(i));
+	ASSERT_EQ(allocations, before);
+
+	b.set_pool_limit(0);
+	ASSERT_EQ(b.pool_limit(), 0);
+	b.erase(b.insert(1));
+	ASSERT_GT(allocations, before);
+}
+
+TEST(layout, payload_is_cache_line_aligned)
+{
+	BucketStorage< char > b(3);
+	for (char c = 'a'; c < 'm'; ++c)
+		b.insert(c);
+	for (const auto &bucket : b.buckets())
+		ASSERT_EQ(reinterpret_cast< std::uintptr_t >(&*bucket.begin()) % 64, 0);
+
+	struct alignas(128) Wide
+	{
+		int value;
+	};
+	BucketStorage< Wide > wide(5);
+	for (int i = 0; i < 20; ++i)
+		wide.insert(Wide{ i });
+	for (const Wide &w : wide)
+		ASSERT_EQ(reinterpret_cast< std::uintptr_t >(&w) % 128, 0);
+
+	b.set_huge_pages(true);
+	ASSERT_TRUE(b.huge_pages());
+	for (int i = 0; i < 10; ++i)
+		b.insert('z');
+	ASSERT_EQ(b.size(), 22);
+}
+
+TEST(insertion, emplace_constructs_in_place)
+{
+	BucketStorage< std::string > b(4);
+	auto it = b.emplace(3, 'x');
+	ASSERT_EQ(*it, "xxx");
+
+	struct Pinned
+	{
+		Pinned(int a, int b) : sum(a + b) {}
+		Pinned(const Pinned &) = delete;
+		int sum;
+	};
+	BucketStorage< Pinned > pinned(4);
+	for (int i = 0; i < 10; ++i)
+		pinned.emplace(i, 1);
+	ASSERT_EQ(pinned.size(), 10);
+	int total = 0;
+	for (const Pinned &p : pinned)
+		total += p.sum;
+	ASSERT_EQ(total, 55);
+}
+
+TEST(insertion, insert_range_from_input_and_forward_iterators)
+{
+	std::istringstream input("1 2 3 4 5 6 7 8 9");
+	BucketStorage< int > numbers(4);
+	numbers.insert_range(std::istream_iterator< int >(input), std::istream_iterator< int >());
+	ASSERT_EQ(numbers.size(), 9);
+	ASSERT_EQ(std::accumulate(numbers.begin(), numbers.end(), 0), 45);
+
+	std::vector< int > more(100, 1);
+	numbers.insert_range(more.begin(), more.end());
+	ASSERT_EQ(numbers.size(), 109);
+	ASSERT_EQ(std::accumulate(numbers.begin(), numbers.end(), 0), 145);
+
+	numbers.insert({ 1000, 2000 });
+	ASSERT_EQ(numbers.size(), 111);
+	BucketStorage< int > constructed(more.begin(), more.end(), 8);
+	ASSERT_EQ(constructed.size(), 100);
+	ASSERT_EQ(constructed.capacity(), 104);
+}
+
+TEST(order, nth_rank_distance)
+{
+	BucketStorage< int > b(4);
+	for (int i = 0; i < 30; ++i)
+		b.insert(i);
+	for (int i = 4; i < 8; ++i)
+		b.erase(std::find(b.begin(), b.end(), i));
+	b.erase(std::find(b.begin(), b.end(), 20));
+
+	size_t k = 0;
+	for (auto it = b.begin(); it != b.end(); ++it, ++k)
+	{
+		ASSERT_EQ(b.nth(k), it);
+		ASSERT_EQ(b.rank(it), k);
+		ASSERT_EQ(b.distance(b.begin(), it), static_cast< long >(k));
+	}
+	ASSERT_EQ(b.nth(b.size()), b.end());
+	ASSERT_EQ(b.get_to_distance(b.begin(), 10), b.nth(10));
+}
+
+TEST(order, directory_stays_bounded_under_fifo_churn)
+{
+	BucketStorage< int > b(64);
+	for (int i = 0; i < 1000; ++i)
+		b.insert(i);
+	for (int round = 0; round < 20000; ++round)
+	{
+		for (int i = 0; i < 64; ++i)
+			b.insert(round * 64 + i);
+		for (int i = 0; i < 64; ++i)
+			b.erase(b.nth(0));
+	}
+	size_t live = 0;
+	for (const auto &bucket : b.buckets())
+		live += bucket.size() != 0;
+	ASSERT_EQ(b.size(), 1000);
+	ASSERT_LE(b.buckets().size(), 2 * live + 2);
+
+	for (int i = 0; i < 200; ++i)
+		b.insert(-i);
+	size_t k = 0;
+	for (auto it = b.begin(); it != b.end(); ++it, ++k)
+	{
+		ASSERT_EQ(b.nth(k), it);
+		ASSERT_EQ(b.rank(it), k);
+	}
+}
+
+TEST(parallel, for_each_and_reduce)
+{
+	BucketStorage< long > b(32);
+	for (long i = 0; i < 5000; ++i)
+		b.insert(i);
+	for (long i = 0; i < 5000; i += 5)
+		b.erase(b.nth(0));
+
+	std::atomic< long > sum(0);
+	b.parallel_for_each([&](long &v) { sum += v; }, 4);
+	long expected = std::accumulate(b.begin(), b.end(), 0L);
+	ASSERT_EQ(sum.load(), expected);
+	ASSERT_EQ(b.parallel_reduce(0L, std::plus<>(), std::identity(), 4), expected);
+	ASSERT_EQ(b.parallel_reduce(size_t(0), std::plus<>(), [](long) { return size_t(1); }, 3), b.size());
+}
+
+TEST(segments, cover_every_element)
+{
+	BucketStorage< int > b(16);
+	for (int i = 0; i < 100; ++i)
+		b.insert(i);
+	for (int i = 0; i < 100; i += 7)
+		b.erase(std::find(b.begin(), b.end(), i));
+
+	size_t count = 0;
+	long sum = 0;
+	for (std::span< int > span : b.segments())
+	{
+		count += span.size();
+		sum = std::accumulate(span.begin(), span.end(), sum);
+	}
+	ASSERT_EQ(count, b.size());
+	ASSERT_EQ(sum, std::accumulate(b.begin(), b.end(), 0L));
+
+	size_t bucketed = 0;
+	for (const auto &bucket : b.buckets())
+		bucketed += bucket.size();
+	ASSERT_EQ(bucketed, b.size());
+}
+
+TEST(pmr, allocates_from_resource)
+{
+	std::array< std::byte, 1 << 16 > buffer;
+	std::pmr::monotonic_buffer_resource resource(buffer.data(), buffer.size(), std::pmr::null_memory_resource());
+	pmr::BucketStorage< int > b(32, 1, &resource);
+	for (int i = 0; i < 300; ++i)
+		b.insert(i);
+	b.erase(b.nth(10));
+	ASSERT_EQ(b.size(), 299);
+	ASSERT_EQ(b.get_allocator().resource(), &resource);
+
+	pmr::BucketStorage< int > copy(b, &resource);
+	ASSERT_TRUE(std::equal(copy.begin(), copy.end(), b.begin(), b.end()));
+}
+
+TEST(handles, resolve_and_invalidate)
+{
+	BucketStorage< std::string > b(4);
+	std::vector< BucketStorage< std::string >::handle > handles;
+	for (int i = 0; i < 12; ++i)
+		handles.push_back(b.handle_of(b.insert(std::to_string(i))));
+	for (int i = 0; i < 12; ++i)
+		ASSERT_EQ(*b.get(handles[i]), std::to_string(i));
+
+	std::string *element = b.get(handles[5]);
+	b.erase(element);
+	ASSERT_EQ(b.get(handles[5]), nullptr);
+
+	auto reused = b.insert("reused");
+	ASSERT_EQ(&*reused, element);
+	ASSERT_EQ(b.get(handles[5]), nullptr);
+	ASSERT_EQ(*b.get(b.handle_of(reused)), "reused");
+	ASSERT_EQ(*b.get(handles[6]), "6");
+
+	b.clear();
+	for (auto &h : handles)
+		ASSERT_EQ(b.get(h), nullptr);
+}
+
+TEST(handles, survive_copies_with_holes)
+{
+	BucketStorage< int > b(4);
+	for (int i = 0; i < 16; ++i)
+		b.insert(i);
+	for (int i = 0; i < 4; ++i)
+		b.erase(b.nth(4));
+	auto h = b.handle_of(b.nth(8));
+
+	BucketStorage< int > copy = b;
+	ASSERT_NE(copy.get(h), nullptr);
+	ASSERT_EQ(*copy.get(h), *b.get(h));
+
+	BucketStorage< int > assigned(4);
+	assigned.insert(100);
+	assigned = b;
+	ASSERT_NE(assigned.get(h), nullptr);
+	ASSERT_EQ(*assigned.get(h), *b.get(h));
+}
+
+TEST(compaction, relocation_callbacks_track_elements)
+{
+	BucketStorage< int > b(8);
+	std::map< int, BucketStorage< int >::handle > handles;
+	for (int i = 0; i < 64; ++i)
+		handles[i] = b.handle_of(b.insert(i));
+	for (int i = 0; i < 64; ++i)
+		if (i % 4 != 0)
+		{
+			b.erase(b.get(handles[i]));
+			handles.erase(i);
+		}
+	size_t capacity = b.capacity();
+
+	size_t relocations = 0;
+	auto relocate = [&](const BucketStorage< int >::handle &from, const BucketStorage< int >::handle &to)
+	{
+		relocations++;
+		auto found = std::find_if(handles.begin(), handles.end(), [&](const auto &entry) { return entry.second == from; });
+		ASSERT_NE(found, handles.end());
+		found->second = to;
+	};
+	while (b.compact_step(3, relocate))
+	{
+	}
+
+	ASSERT_GT(relocations, 0);
+	ASSERT_LT(b.capacity(), capacity);
+	ASSERT_EQ(b.size(), handles.size());
+	for (auto &[value, h] : handles)
+	{
+		ASSERT_NE(b.get(h), nullptr);
+		ASSERT_EQ(*b.get(h), value);
+	}
+	ASSERT_FALSE(b.compact_step(1));
+}
+
+TEST(copy, copies_only_live_slots)
+{
+	BucketStorage< Tracked > b(16);
+	for (int i = 0; i < 100; ++i)
+		b.emplace(i);
+	for (auto it = b.begin(); it != b.end();)
+		it = it->value % 5 != 0 ? b.erase(it) : std::next(it);
+
+	Tracked::copies = 0;
+	BucketStorage< Tracked > copy = b;
+	ASSERT_EQ(Tracked::copies, 20);
+	ASSERT_EQ(copy.size(), 20);
+	for (const Tracked &t : copy)
+		ASSERT_EQ(t.value % 5, 0);
+
+	BucketStorage< int > plain(16);
+	for (int i = 0; i < 100; ++i)
+		plain.insert(i);
+	for (int i = 0; i < 100; i += 2)
+		plain.erase(std::find(plain.begin(), plain.end(), i));
+	BucketStorage< int > plain_copy = plain;
+	ASSERT_TRUE(std::equal(plain_copy.begin(), plain_copy.end(), plain.begin(), plain.end()));
+}
+
+TEST(clear, destroys_live_elements_and_keeps_storage_usable)
+{
+	BucketStorage< Tracked > b(16);
+	for (int i = 0; i < 50; ++i)
+		b.emplace(i);
+	b.erase(b.begin());
+	Tracked::destroyed = 0;
+	b.clear();
+	ASSERT_EQ(Tracked::destroyed, 49);
+	ASSERT_TRUE(b.empty());
+
+	BucketStorage< int > plain(16);
+	for (int i = 0; i < 100; ++i)
+		plain.insert(i);
+	plain.clear();
+	ASSERT_TRUE(plain.empty());
+	ASSERT_EQ(plain.capacity(), 0);
+	ASSERT_EQ(plain.begin(), plain.end());
+	for (int i = 0; i < 20; ++i)
+		plain.insert(i);
+	ASSERT_EQ(std::accumulate(plain.begin(), plain.end(), 0), 190);
+}
+
+TEST(fixed, blocks_have_compile_time_capacity)
+{
+	FixedBucketStorage< int, 8 > b;
+	for (int i = 0; i < 20; ++i)
+		b.insert(i);
+	ASSERT_EQ(b.capacity(), 24);
+	for (const auto &bucket : b.buckets())
+		ASSERT_LE(bucket.size(), 8);
+	FixedBucketStorage< int, 8 > copy = b;
+	ASSERT_TRUE(std::equal(copy.begin(), copy.end(), b.begin(), b.end()));
+}
+
+TEST(small, inline_block_does_not_allocate)
+{
+	size_t allocations = 0;
+	{
+		SmallBucketStorage< int, 16, CountingAllocator< int > > b(16, 1, CountingAllocator< int >(&allocations));
+		for (int i = 0; i < 16; ++i)
+			b.insert(i);
+		auto h = b.handle_of(b.nth(3));
+		ASSERT_EQ(*b.get(h), 3);
+		ASSERT_EQ(b.rank(b.nth(7)), 7);
+		ASSERT_EQ(b.iterator_to(&*b.nth(5)), b.nth(5));
+		b.erase(&*b.nth(0));
+		ASSERT_EQ(b.size(), 15);
+		ASSERT_EQ(allocations, 0);
+
+		b.insert(16);
+		b.insert(17);
+		ASSERT_GT(allocations, 0);
+		ASSERT_EQ(*b.get(h), 3);
+		for (size_t k = 0; k < b.size(); ++k)
+			ASSERT_EQ(b.iterator_to(&*b.nth(k)), b.nth(k));
+
+		SmallBucketStorage< int, 16, CountingAllocator< int > > moved = std::move(b);
+		ASSERT_EQ(moved.size(), 17);
+		ASSERT_EQ(*moved.get(h), 3);
+	}
+}
+
+TEST(small, footprint_stays_compact)
+{
+#ifndef BUCKET_STORAGE_STATS
+	static_assert(sizeof(BucketStorage< int >) <= 16 * sizeof(void *));
+	static_assert(sizeof(SmallBucketStorage< int, 16 >) - sizeof(BucketStorage< int >) <= 512);
+#endif
+	size_t allocations = 0;
+	SmallBucketStorage< int, 16, CountingAllocator< int > > b(16, 1, CountingAllocator< int >(&allocations));
+	b.set_reuse_policy(decltype(b)::slot_reuse::densest);
+	for (int i = 0; i < 20; ++i)
+		b.insert(i);
+	b.erase(std::find(b.begin(), b.end(), 2));
+	b.erase(std::find(b.begin(), b.end(), 18));
+
+	auto copy = b;
+	ASSERT_EQ(copy.size(), 18);
+	size_t capacity = copy.capacity();
+	auto it = copy.insert(100);
+	ASSERT_EQ(copy.handle_of(it).block, copy.handle_of(copy.begin()).block);
+	copy.insert(101);
+	ASSERT_EQ(copy.capacity(), capacity);
+	ASSERT_EQ(std::accumulate(copy.begin(), copy.end(), 0), 190 - 2 - 18 + 201);
+}
+
+TEST(reuse, densest_fills_fullest_block)
+{
+	using storage = BucketStorage< int >;
+	for (auto policy : { storage::slot_reuse::recent, storage::slot_reuse::densest })
+	{
+		storage b(8);
+		b.set_reuse_policy(policy);
+		ASSERT_EQ(b.reuse_policy(), policy);
+		for (int i = 0; i < 24; ++i)
+			b.insert(i);
+		b.erase(std::find(b.begin(), b.end(), 0));
+		for (int i = 8; i < 15; ++i)
+			b.erase(std::find(b.begin(), b.end(), i));
+
+		auto it = b.insert(100);
+		size_t block = b.handle_of(it).block;
+		size_t sparse = b.handle_of(std::find(b.begin(), b.end(), 15)).block;
+		size_t dense = b.handle_of(std::find(b.begin(), b.end(), 1)).block;
+		ASSERT_EQ(block, policy == storage::slot_reuse::densest ? dense : sparse);
+	}
+}
+
+TEST(reuse, copies_keep_the_policy)
+{
+	using storage = BucketStorage< int >;
+	storage b(8);
+	b.set_reuse_policy(storage::slot_reuse::densest);
+	for (int i = 0; i < 24; ++i)
+		b.insert(i);
+
+	storage copy = b;
+	ASSERT_EQ(copy.reuse_policy(), storage::slot_reuse::densest);
+	storage assigned(8);
+	assigned = b;
+	ASSERT_EQ(assigned.reuse_policy(), storage::slot_reuse::densest);
+	storage moved = std::move(copy);
+	ASSERT_EQ(moved.reuse_policy(), storage::slot_reuse::densest);
+}
+
+TEST(pointers, iterator_to_and_erase)
+{
+	BucketStorage< int > b(4);
+	for (int i = 0; i < 20; ++i)
+		b.insert(i);
+	for (auto it = b.begin(); it != b.end(); ++it)
+		ASSERT_EQ(b.iterator_to(&*it), it);
+
+	const int *seven = &*std::find(b.begin(), b.end(), 7);
+	auto next = b.erase(seven);
+	ASSERT_EQ(*next, 8);
+	ASSERT_EQ(b.size(), 19);
+	ASSERT_EQ(std::find(b.begin(), b.end(), 7), b.end());
+}
+
+TEST(splice, moves_all_elements)
+{
+	BucketStorage< int > a(4), b(4);
+	for (int i = 0; i < 10; ++i)
+		a.insert(i);
+	for (int i = 10; i < 25; ++i)
+		b.insert(i);
+	auto h = a.handle_of(std::find(a.begin(), a.end(), 3));
+
+	a.splice(std::move(b));
+	ASSERT_EQ(a.size(), 25);
+	ASSERT_TRUE(b.empty());
+	ASSERT_EQ(std::accumulate(a.begin(), a.end(), 0), 300);
+	ASSERT_EQ(*a.get(h), 3);
+	for (size_t k = 0; k < a.size(); ++k)
+		ASSERT_EQ(a.rank(a.nth(k)), k);
+
+	a.erase(a.get(h));
+	auto reused = a.insert(-1);
+	ASSERT_EQ(*a.get(a.handle_of(reused)), -1);
+	ASSERT_EQ(a.get(h), nullptr);
+}
+
+TEST(concurrent, insert_erase_from_many_threads)
+{
+	ConcurrentBucketStorage< long > b(4, 16);
+	ASSERT_EQ(b.shard_count(), 4);
+	constexpr long per_thread = 2000;
+	constexpr int threads = 8;
+	std::vector< std::vector< const long * > > pointers(threads);
+	std::vector< std::thread > workers;
+	for (int t = 0; t < threads; ++t)
+		workers.emplace_back(
+			[&, t]
+			{
+				for (long i = 0; i < per_thread; ++i)
+				{
+					auto h = b.insert(t * per_thread + i);
+					b.visit(h, [&](long &v) { pointers[t].push_back(&v); });
+				}
+			});
+	for (auto &worker : workers)
+		worker.join();
+	ASSERT_EQ(b.size(), threads * per_thread);
+
+	workers.clear();
+	for (int t = 0; t < threads; ++t)
+		workers.emplace_back(
+			[&, t]
+			{
+				auto &mine = pointers[(t + 1) % threads];
+				for (size_t i = 0; i < mine.size(); i += 2)
+					ASSERT_TRUE(b.erase(mine[i]));
+				for (long i = 0; i < 100; ++i)
+					b.erase(b.insert(-1));
+			});
+	for (auto &worker : workers)
+		worker.join();
+	ASSERT_EQ(b.size(), threads * per_thread / 2);
+
+	long odd = 0;
+	b.for_each([&](long v) { odd += v % 2; });
+	ASSERT_EQ(odd, threads * per_thread / 2);
+
+	auto h = b.insert(7);
+	ASSERT_TRUE(b.erase(h));
+	ASSERT_FALSE(b.erase(h));
+	ASSERT_FALSE(b.visit(h, [](long &) {}));
+
+	BucketStorage< long > collected = b.collect();
+	ASSERT_EQ(collected.size(), threads * per_thread / 2);
+	ASSERT_TRUE(b.empty());
+}
+
+TEST(lockfree, concurrent_insert_erase_and_iterate)
+{
+	using storage = LockFreeBucketStorage< std::string >;
+	storage b(16);
+	std::atomic< bool > stop(false);
+	std::atomic< bool > failed(false);
+	std::vector< std::thread > readers;
+	for (int r = 0; r < 2; ++r)
+		readers.emplace_back(
+			[&]
+			{
+				while (!stop.load())
+					for (std::string &v : b.pin())
+						if (v.empty())
+							failed = true;
+			});
+	std::vector< std::thread > writers;
+	for (int t = 0; t < 6; ++t)
+		writers.emplace_back(
+			[&, t]
+			{
+				std::vector< storage::handle > handles;
+				for (int round = 0; round < 20; ++round)
+				{
+					for (int i = 0; i < 200; ++i)
+						handles.push_back(b.insert(std::to_string(t) + "/" + std::to_string(i)));
+					for (auto &h : handles)
+					{
+						if (!b.visit(h, [&](std::string &v) { failed = failed || v.empty(); }) || !b.erase(h) || b.erase(h))
+							failed = true;
+					}
+					handles.clear();
+				}
+				for (int i = 0; i < 50; ++i)
+					b.emplace(3, 'k');
+			});
+	for (auto &writer : writers)
+		writer.join();
+	stop = true;
+	for (auto &reader : readers)
+		reader.join();
+
+	ASSERT_FALSE(failed.load());
+	ASSERT_EQ(b.size(), 300);
+	size_t count = 0;
+	b.for_each(
+		[&](std::string &v)
+		{
+			ASSERT_EQ(v, "kkk");
+			count++;
+		});
+	ASSERT_EQ(count, 300);
+}
+
+TEST(lockfree, stale_handle_after_slot_reuse)
+{
+	using storage = LockFreeBucketStorage< int >;
+	storage b(4);
+	auto stale = b.insert(1);
+	ASSERT_TRUE(b.erase(stale));
+	for (int i = 0; i < 100; ++i)
+		(void)b.pin();
+
+	std::vector< storage::handle > fresh;
+	for (int i = 0; i < 16; ++i)
+		fresh.push_back(b.insert(i));
+	ASSERT_FALSE(b.visit(stale, [](int &) {}));
+	ASSERT_FALSE(b.erase(stale));
+	ASSERT_EQ(b.size(), 16);
+	for (int i = 0; i < 16; ++i)
+	{
+		int seen = -1;
+		ASSERT_TRUE(b.visit(fresh[i], [&](int &v) { seen = v; }));
+		ASSERT_EQ(seen, i);
+	}
+	ASSERT_FALSE(b.erase(storage::handle()));
+
+	b.clear();
+	ASSERT_TRUE(b.empty());
+	for (auto &h : fresh)
+		ASSERT_FALSE(b.visit(h, [](int &) {}));
+}
+
+TEST(snapshot, save_and_map_round_trip)
+{
+	std::string path = scratchPath("bucket_snapshot");
+	BucketStorage< long > b(16);
+	for (long i = 0; i < 100; ++i)
+		b.insert(i * i);
+	for (long i = 0; i < 100; i += 9)
+		b.erase(std::find(b.begin(), b.end(), i * i));
+	auto h = b.handle_of(std::find(b.begin(), b.end(), 49));
+	b.save(path.c_str());
+
+	{
+		BucketStorage< long > mapped = BucketStorage< long >::map(path.c_str());
+		ASSERT_EQ(mapped.size(), b.size());
+		ASSERT_TRUE(std::equal(mapped.begin(), mapped.end(), b.begin(), b.end()));
+		ASSERT_EQ(*mapped.get(h), 49);
+
+		mapped.erase(mapped.get(h));
+		for (long i = 0; i < 50; ++i)
+			mapped.insert(-i);
+		ASSERT_EQ(mapped.size(), b.size() + 49);
+		ASSERT_EQ(mapped.get(h), nullptr);
+	}
+
+	BucketStorage< long > again = BucketStorage< long >::map(path.c_str());
+	ASSERT_TRUE(std::equal(again.begin(), again.end(), b.begin(), b.end()));
+	std::filesystem::remove(path);
+}
+
+TEST(snapshot, map_keeps_block_numbers_across_holes)
+{
+	std::string path = scratchPath("bucket_snapshot_holes");
+	BucketStorage< long > b(8);
+	for (long i = 0; i < 40; ++i)
+		b.insert(i);
+	for (long i = 8; i < 16; ++i)
+		b.erase(std::find(b.begin(), b.end(), i));
+	auto h = b.handle_of(std::find(b.begin(), b.end(), 30));
+	b.save(path.c_str());
+
+	BucketStorage< long > mapped = BucketStorage< long >::map(path.c_str());
+	ASSERT_NE(mapped.get(h), nullptr);
+	ASSERT_EQ(*mapped.get(h), 30);
+	for (long i = 100; i < 108; ++i)
+		mapped.insert(i);
+	ASSERT_EQ(*mapped.get(h), 30);
+	size_t k = 0;
+	for (auto it = mapped.begin(); it != mapped.end(); ++it, ++k)
+		ASSERT_EQ(mapped.rank(it), k);
+	std::filesystem::remove(path);
+}
+
+TEST(snapshot, rejects_bad_files)
+{
+	std::string path = scratchPath("bucket_snapshot_bad");
+	ASSERT_THROW(BucketStorage< long >::map(path.c_str()), std::system_error);
+
+	{
+		std::ofstream out(path, std::ios::binary);
+		out << std::string(4096, 'x');
+	}
+	ASSERT_THROW(BucketStorage< long >::map(path.c_str()), std::system_error);
+
+	BucketStorage< long > b;
+	for (long i = 0; i < 10; ++i)
+		b.insert(i);
+	b.save(path.c_str());
+	ASSERT_THROW(BucketStorage< int >::map(path.c_str()), std::system_error);
+
+	std::filesystem::resize_file(path, std::filesystem::file_size(path) / 2);
+	ASSERT_THROW(BucketStorage< long >::map(path.c_str()), std::system_error);
+	std::filesystem::remove(path);
+}
+
+TEST(persistent, reopen_keeps_elements)
+{
+	std::string path = scratchPath("bucket_persistent");
+	std::filesystem::remove(path);
+	{
+		PersistentBucketStorage< long > b(path.c_str(), 16);
+		for (long i = 0; i < 200; ++i)
+			b.insert(i);
+		for (auto it = b.begin(); it != b.end();)
+			it = *it % 2 == 0 ? b.erase(it) : std::next(it);
+		ASSERT_EQ(b.size(), 100);
+	}
+	{
+		PersistentBucketStorage< long > b(path.c_str());
+		ASSERT_EQ(b.size(), 100);
+		ASSERT_EQ(b.block_capacity(), 16);
+		long sum = 0;
+		for (long v : b)
+		{
+			ASSERT_EQ(v % 2, 1);
+			sum += v;
+		}
+		ASSERT_EQ(sum, 100 * 100);
+		b.insert(1000);
+	}
+	{
+		PersistentBucketStorage< long > b(path.c_str());
+		ASSERT_EQ(b.size(), 101);
+		b.clear();
+		ASSERT_TRUE(b.empty());
+	}
+	std::filesystem::remove(path);
+}
+
+TEST(persistent, recovers_after_unclean_close)
+{
+	std::string path = scratchPath("bucket_persistent_crash");
+	std::filesystem::remove(path);
+	{
+		PersistentBucketStorage< long > b(path.c_str(), 8);
+		for (long i = 0; i < 20; ++i)
+			b.insert(i);
+	}
+
+	pid_t child = fork();
+	ASSERT_NE(child, -1);
+	if (child == 0)
+	{
+		PersistentBucketStorage< long > b(path.c_str());
+		for (long i = 20; i < 50; ++i)
+			b.insert(i);
+		for (auto it = b.begin(); it != b.end();)
+			it = *it < 10 ? b.erase(it) : std::next(it);
+		_exit(0);
+	}
+	int status = 0;
+	ASSERT_EQ(waitpid(child, &status, 0), child);
+	ASSERT_TRUE(WIFEXITED(status));
+
+	{
+		std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+		uint64_t bogus = 12345;
+		file.seekp(88);
+		file.write(reinterpret_cast< const char * >(&bogus), sizeof(bogus));
+	}
+
+	{
+		PersistentBucketStorage< long > b(path.c_str());
+		ASSERT_EQ(b.size(), 40);
+		std::vector< long > values(b.begin(), b.end());
+		std::sort(values.begin(), values.end());
+		std::vector< long > expected(40);
+		std::iota(expected.begin(), expected.end(), 10);
+		ASSERT_EQ(values, expected);
+		for (long i = 0; i < 30; ++i)
+			b.insert(-i);
+		ASSERT_EQ(b.size(), 70);
+	}
+	{
+		PersistentBucketStorage< long > b(path.c_str());
+		ASSERT_EQ(b.size(), 70);
+	}
+	std::filesystem::remove(path);
+}
+
+TEST(persistent, rejects_foreign_files)
+{
+	std::string path = scratchPath("bucket_persistent_bad");
+	{
+		std::ofstream out(path, std::ios::binary);
+		out << std::string(8192, 'z');
+	}
+	ASSERT_THROW(PersistentBucketStorage< long >(path.c_str()), std::system_error);
+	std::filesystem::remove(path);
+}
+
+TEST(pool, geometric_churn_hits_pool)
+{
+	size_t allocations = 0;
+	BucketStorage< int, CountingAllocator< int > > b(BucketStorage< int, CountingAllocator< int > >::block_growth::geometric,
+													  8,
+													  256,
+													  CountingAllocator< int >(&allocations));
+	b.set_pool_limit(8);
+	for (int i = 0; i < 300; ++i)
+		b.insert(i);
+	while (b.size() > 8)
+		b.erase(b.nth(b.size() - 1));
+
+	size_t before = allocations;
+	for (int round = 0; round < 10; ++round)
+	{
+		for (int i = 0; i < 300; ++i)
+			b.insert(i);
+		while (b.size() > 8)
+			b.erase(b.nth(b.size() - 1));
+	}
+	ASSERT_EQ(allocations, before);
+}
+
+TEST(growth, geometric_blocks_double_up_to_limit)
+{
+	BucketStorage< int > b(BucketStorage< int >::block_growth::geometric, 4, 32);
+	ASSERT_EQ(b.growth_policy(), BucketStorage< int >::block_growth::geometric);
+	ASSERT_EQ(b.max_block_capacity(), 32);
+	std::vector< size_t > blocks;
+	for (int i = 0; i < 200; ++i)
+	{
+		size_t capacity = b.capacity();
+		b.insert(i);
+		if (b.capacity() != capacity)
+			blocks.push_back(b.capacity() - capacity);
+	}
+	ASSERT_EQ(blocks, std::vector< size_t >({ 4, 4, 8, 16, 32, 32, 32, 32, 32, 32 }));
+
+	b.set_growth_policy(BucketStorage< int >::block_growth::fixed);
+	ASSERT_EQ(b.growth_policy(), BucketStorage< int >::block_growth::fixed);
+	size_t capacity = b.capacity();
+	while (b.size() != b.capacity())
+		b.insert(0);
+	b.insert(0);
+	ASSERT_EQ(b.capacity(), b.size() + 3);
+	ASSERT_GT(b.capacity(), capacity);
+}
+
+#ifdef BUCKET_STORAGE_STATS
+TEST(stats, counts_operations)
+{
+	BucketStorage< int > b(8, 1);
+	for (int i = 0; i < 9; ++i)
+		b.insert(i);
+	b.erase(b.nth(8));
+	b.erase(b.nth(0));
+	b.insert(100);
+	b.insert(101);
+
+	auto s = b.stats();
+	ASSERT_EQ(s.inserts, 11);
+	ASSERT_EQ(s.erases, 2);
+	ASSERT_EQ(s.elements, b.size());
+	ASSERT_EQ(s.slots, b.capacity());
+	ASSERT_EQ(s.block_allocations, 2);
+	ASSERT_EQ(s.pool_hits, 1);
+	ASSERT_GE(s.reused_slots, 1);
+
+	b.reset_stats();
+	ASSERT_EQ(b.stats().inserts, 0);
+	ASSERT_EQ(b.stats().elements, b.size());
+}
+#endif
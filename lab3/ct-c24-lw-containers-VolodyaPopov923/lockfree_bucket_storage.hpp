@@ -0,0 +1,799 @@
+#ifndef LOCKFREE_BUCKET_STORAGE
+#define LOCKFREE_BUCKET_STORAGE
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+template< typename T, typename Allocator = std::allocator< T > >
+class LockFreeBucketStorage
+{
+  public:
+	using value_type = T;
+	using allocator_type = Allocator;
+	using pointer = T *;
+	using reference = T &;
+	using difference_type = long;
+	using size_type = size_t;
+	static_assert(std::is_same_v< typename std::allocator_traits< Allocator >::value_type, T >);
+	class handle;
+	class iterator;
+	class range;
+	static constexpr size_t default_capacity = 64;
+
+  public:
+	explicit LockFreeBucketStorage(size_t block_capacity = default_capacity, const Allocator &alloc = Allocator());
+	LockFreeBucketStorage(const LockFreeBucketStorage &other) = delete;
+	LockFreeBucketStorage &operator=(const LockFreeBucketStorage &other) = delete;
+	~LockFreeBucketStorage();
+
+	allocator_type get_allocator() const noexcept;
+
+	handle insert(const T &value);
+	handle insert(T &&value);
+	template< typename... Args >
+	handle emplace(Args &&...args);
+
+	bool erase(handle h);
+	template< typename F >
+	bool visit(handle h, F f);
+	handle handle_of(iterator it) const noexcept;
+
+	range pin();
+	template< typename F >
+	void for_each(F f);
+	void clear();
+
+	size_type size() const noexcept;
+	bool empty() const noexcept;
+
+  private:
+	using alloc_traits = std::allocator_traits< Allocator >;
+
+	class Block
+	{
+	  public:
+		static constexpr size_t word_bits = 64;
+		static constexpr size_t cache_line = 64;
+		static constexpr size_t sealed = size_t(1) << (std::numeric_limits< size_t >::digits - 1);
+
+		struct alignas(alignof(T) > cache_line ? alignof(T) : cache_line) line
+		{
+			unsigned char bytes[alignof(T) > cache_line ? alignof(T) : cache_line];
+		};
+
+		static Block *create(size_t capacity, Allocator &alloc);
+		static void destroy(Block *block, Allocator &alloc) noexcept;
+		static constexpr size_t dataOffset(size_t capacity) noexcept;
+		static constexpr size_t units(size_t capacity) noexcept;
+
+		explicit Block(size_t capacity) noexcept;
+		Block(const Block &other) = delete;
+		~Block() = default;
+		const size_t capacity;
+		T *data;
+		std::atomic< uint64_t > *claimed;
+		std::atomic< uint64_t > *published;
+		std::atomic< uint64_t > *stamps;
+		std::atomic< size_t > live;
+		std::atomic< Block * > fwd;
+		bool reserve() noexcept;
+		size_t claim(size_t start) noexcept;
+		bool isPublished(size_t i) const noexcept;
+		bool holds(size_t i, uint64_t generation) const noexcept;
+		size_t seek(size_t from) const noexcept;
+		size_t words() const noexcept;
+	};
+
+	enum class Stage : uint8_t
+	{
+		slot,
+		unlinked,
+		block,
+	};
+
+	struct Retired
+	{
+		Block *block;
+		size_t slot;
+		Stage stage;
+	};
+
+	using retired_allocator = typename alloc_traits::template rebind_alloc< Retired >;
+	using retired_list = std::vector< Retired, retired_allocator >;
+
+	struct Bag
+	{
+		uint64_t epoch;
+		retired_list items;
+	};
+
+	struct alignas(64) Participant
+	{
+		explicit Participant(const Allocator &alloc);
+		std::atomic< uint64_t > local;
+		std::atomic< bool > in_use;
+		Participant *next;
+		size_t pins;
+		std::array< Bag, 3 > limbo;
+	};
+
+	using participant_allocator = typename alloc_traits::template rebind_alloc< Participant >;
+	using participant_traits = std::allocator_traits< participant_allocator >;
+
+	class Guard
+	{
+	  public:
+		explicit Guard(LockFreeBucketStorage &storage);
+		Guard(const Guard &other) = delete;
+		Guard &operator=(const Guard &other) = delete;
+		~Guard();
+		void retire(Block *block, size_t slot, Stage stage);
+
+	  private:
+		LockFreeBucketStorage &storage;
+		Participant *self;
+		uint64_t epoch;
+	};
+
+  public:
+	class handle
+	{
+	  public:
+		handle() = default;
+
+		bool operator==(const handle &other) const = default;
+
+	  private:
+		friend LockFreeBucketStorage;
+		handle(Block *block, size_t slot, uint64_t generation) noexcept : block(block), slot(slot), generation(generation) {}
+		Block *block = nullptr;
+		size_t slot = 0;
+		uint64_t generation = 0;
+	};
+
+	class iterator
+	{
+	  public:
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = T;
+		using pointer = T *;
+		using reference = T &;
+		using difference_type = long;
+
+		iterator() = default;
+
+		iterator &operator++();
+		iterator operator++(int);
+
+		reference operator*() const;
+		pointer operator->() const;
+
+		bool operator==(const iterator &a) const;
+
+	  private:
+		friend LockFreeBucketStorage;
+		iterator(Block *block, size_t slot);
+		void settle();
+		Block *block = nullptr;
+		size_t slot = 0;
+	};
+
+	class range
+	{
+	  public:
+		range(const range &other) = delete;
+		range &operator=(const range &other) = delete;
+
+		iterator begin() const;
+		iterator end() const;
+
+	  private:
+		friend LockFreeBucketStorage;
+		explicit range(LockFreeBucketStorage &storage);
+		Guard guard;
+		Block *head;
+	};
+
+  private:
+	static constexpr size_t advance_period = 64;
+	static bool marked(Block *block) noexcept;
+	static Block *mark(Block *block) noexcept;
+	static Block *strip(Block *block) noexcept;
+	static size_t threadSlot() noexcept;
+	static uint64_t nextId() noexcept;
+	Participant *acquire();
+	void tryAdvance() noexcept;
+	Block *freshBlock();
+	void recycle(Block *block) noexcept;
+	Block *reserveBlock(Guard &guard);
+	bool unpublish(Guard &guard, Block *block, size_t slot);
+	void vacate(Guard &guard, Block *block, size_t slot);
+	void remove(Guard &guard, Block *block);
+	bool unlink(Guard &guard, Block *target);
+	void reclaim(Guard &guard, const Retired &retired);
+	[[no_unique_address]] Allocator alloc;
+	std::atomic< Block * > head;
+	std::atomic< Block * > tail;
+	std::atomic< Block * > hint;
+	std::atomic< Block * > spare;
+	std::atomic< Participant * > participants;
+	std::atomic< uint64_t > epoch;
+	std::atomic< size_type > elements;
+	size_type block_capacity;
+	const uint64_t id;
+};
+
+template< typename T, typename Allocator >
+LockFreeBucketStorage< T, Allocator >::LockFreeBucketStorage(size_t block_capacity, const Allocator &alloc) :
+	alloc(alloc), head(nullptr), tail(nullptr), hint(nullptr), spare(nullptr), participants(nullptr), epoch(0), elements(0),
+	block_capacity(block_capacity == 0 ? default_capacity : block_capacity), id(nextId())
+{
+}
+
+template< typename T, typename Allocator >
+LockFreeBucketStorage< T, Allocator >::~LockFreeBucketStorage()
+{
+	participant_allocator participant_alloc(alloc);
+	for (Participant *p = participants.load(std::memory_order_acquire); p != nullptr;)
+	{
+		for (Bag &bag : p->limbo)
+			for (const Retired &retired : bag.items)
+				if (retired.stage == Stage::slot)
+					alloc_traits::destroy(alloc, retired.block->data + retired.slot);
+				else
+					Block::destroy(retired.block, alloc);
+		Participant *next = p->next;
+		participant_traits::destroy(participant_alloc, p);
+		participant_traits::deallocate(participant_alloc, p, 1);
+		p = next;
+	}
+	for (Block *block = head.load(std::memory_order_acquire); block != nullptr;)
+	{
+		Block *next = strip(block->fwd.load(std::memory_order_acquire));
+		Block::destroy(block, alloc);
+		block = next;
+	}
+	for (Block *block = spare.load(std::memory_order_acquire); block != nullptr;)
+	{
+		Block *next = block->fwd.load(std::memory_order_relaxed);
+		Block::destroy(block, alloc);
+		block = next;
+	}
+}
+
+template< typename T, typename Allocator >
+typename LockFreeBucketStorage< T, Allocator >::allocator_type LockFreeBucketStorage< T, Allocator >::get_allocator() const noexcept
+{
+	return alloc;
+}
+
+template< typename T, typename Allocator >
+typename LockFreeBucketStorage< T, Allocator >::handle LockFreeBucketStorage< T, Allocator >::insert(const T &value)
+{
+	return emplace(value);
+}
+template< typename T, typename Allocator >
+typename LockFreeBucketStorage< T, Allocator >::handle LockFreeBucketStorage< T, Allocator >::insert(T &&value)
+{
+	return emplace(std::move(value));
+}
+template< typename T, typename Allocator >
+template< typename... Args >
+typename LockFreeBucketStorage< T, Allocator >::handle LockFreeBucketStorage< T, Allocator >::emplace(Args &&...args)
+{
+	Guard guard(*this);
+	Block *block = reserveBlock(guard);
+	size_t slot = block->claim(threadSlot());
+	try
+	{
+		alloc_traits::construct(alloc, block->data + slot, std::forward< Args >(args)...);
+	} catch (...)
+	{
+		vacate(guard, block, slot);
+		throw;
+	}
+	uint64_t generation = block->stamps[slot].load(std::memory_order_relaxed) + 1;
+	block->stamps[slot].store(generation, std::memory_order_relaxed);
+	block->published[slot / Block::word_bits].fetch_or(uint64_t(1) << (slot % Block::word_bits), std::memory_order_release);
+	elements.fetch_add(1, std::memory_order_relaxed);
+	return handle(block, slot, generation);
+}
+
+template< typename T, typename Allocator >
+bool LockFreeBucketStorage< T, Allocator >::erase(handle h)
+{
+	if (h.block == nullptr)
+		return false;
+	Guard guard(*this);
+	if (!h.block->holds(h.slot, h.generation))
+		return false;
+	return unpublish(guard, h.block, h.slot);
+}
+template< typename T, typename Allocator >
+template< typename F >
+bool LockFreeBucketStorage< T, Allocator >::visit(handle h, F f)
+{
+	if (h.block == nullptr)
+		return false;
+	Guard guard(*this);
+	if (!h.block->holds(h.slot, h.generation))
+		return false;
+	f(h.block->data[h.slot]);
+	return true;
+}
+template< typename T, typename Allocator >
+typename LockFreeBucketStorage< T, Allocator >::handle LockFreeBucketStorage< T, Allocator >::handle_of(iterator it) const noexcept
+{
+	return handle(it.block, it.slot, it.block->stamps[it.slot].load(std::memory_order_acquire));
+}
+
+template< typename T, typename Allocator >
+typename LockFreeBucketStorage< T, Allocator >::range LockFreeBucketStorage< T, Allocator >::pin()
+{
+	return range(*this);
+}
+template< typename T, typename Allocator >
+template< typename F >
+void LockFreeBucketStorage< T, Allocator >::for_each(F f)
+{
+	for (T &value : pin())
+		f(value);
+}
+template< typename T, typename Allocator >
+void LockFreeBucketStorage< T, Allocator >::clear()
+{
+	range pinned(*this);
+	for (iterator it = pinned.begin(); it != pinned.end(); ++it)
+		unpublish(pinned.guard, it.block, it.slot);
+}
+
+template< typename T, typename Allocator >
+typename LockFreeBucketStorage< T, Allocator >::size_type LockFreeBucketStorage< T, Allocator >::size() const noexcept
+{
+	return elements.load(std::memory_order_relaxed);
+}
+template< typename T, typename Allocator >
+bool LockFreeBucketStorage< T, Allocator >::empty() const noexcept
+{
+	return size() == 0;
+}
+
+template< typename T, typename Allocator >
+bool LockFreeBucketStorage< T, Allocator >::marked(Block *block) noexcept
+{
+	return (reinterpret_cast< uintptr_t >(block) & 1) != 0;
+}
+template< typename T, typename Allocator >
+typename LockFreeBucketStorage< T, Allocator >::Block *LockFreeBucketStorage< T, Allocator >::mark(Block *block) noexcept
+{
+	return reinterpret_cast< Block * >(reinterpret_cast< uintptr_t >(block) | 1);
+}
+template< typename T, typename Allocator >
+typename LockFreeBucketStorage< T, Allocator >::Block *LockFreeBucketStorage< T, Allocator >::strip(Block *block) noexcept
+{
+	return reinterpret_cast< Block * >(reinterpret_cast< uintptr_t >(block) & ~uintptr_t(1));
+}
+template< typename T, typename Allocator >
+size_t LockFreeBucketStorage< T, Allocator >::threadSlot() noexcept
+{
+	static std::atomic< size_t > next(0);
+	thread_local size_t slot = next.fetch_add(1, std::memory_order_relaxed);
+	return slot;
+}
+template< typename T, typename Allocator >
+uint64_t LockFreeBucketStorage< T, Allocator >::nextId() noexcept
+{
+	static std::atomic< uint64_t > next(1);
+	return next.fetch_add(1, std::memory_order_relaxed);
+}
+
+template< typename T, typename Allocator >
+typename LockFreeBucketStorage< T, Allocator >::Participant *LockFreeBucketStorage< T, Allocator >::acquire()
+{
+	thread_local std::pair< uint64_t, Participant * > cached(0, nullptr);
+	bool expected = false;
+	if (cached.first == id && cached.second->in_use.compare_exchange_strong(expected, true, std::memory_order_acquire))
+		return cached.second;
+	for (Participant *p = participants.load(std::memory_order_acquire); p != nullptr; p = p->next)
+	{
+		expected = false;
+		if (p->in_use.compare_exchange_strong(expected, true, std::memory_order_acquire))
+		{
+			cached = { id, p };
+			return p;
+		}
+	}
+	participant_allocator participant_alloc(alloc);
+	Participant *fresh = participant_traits::allocate(participant_alloc, 1);
+	participant_traits::construct(participant_alloc, fresh, alloc);
+	fresh->next = participants.load(std::memory_order_relaxed);
+	while (!participants.compare_exchange_weak(fresh->next, fresh, std::memory_order_release, std::memory_order_relaxed))
+	{
+	}
+	cached = { id, fresh };
+	return fresh;
+}
+template< typename T, typename Allocator >
+void LockFreeBucketStorage< T, Allocator >::tryAdvance() noexcept
+{
+	uint64_t current = epoch.load(std::memory_order_seq_cst);
+	for (Participant *p = participants.load(std::memory_order_acquire); p != nullptr; p = p->next)
+	{
+		uint64_t local = p->local.load(std::memory_order_seq_cst);
+		if ((local & 1) != 0 && local >> 1 != current)
+			return;
+	}
+	epoch.compare_exchange_strong(current, current + 1, std::memory_order_seq_cst);
+}
+
+template< typename T, typename Allocator >
+typename LockFreeBucketStorage< T, Allocator >::Block *LockFreeBucketStorage< T, Allocator >::freshBlock()
+{
+	Block *block = spare.load(std::memory_order_acquire);
+	while (block != nullptr &&
+		   !spare.compare_exchange_weak(block, block->fwd.load(std::memory_order_relaxed), std::memory_order_acquire, std::memory_order_acquire))
+	{
+	}
+	if (block == nullptr)
+		return Block::create(block_capacity, alloc);
+	block->fwd.store(nullptr, std::memory_order_relaxed);
+	block->live.store(0, std::memory_order_relaxed);
+	return block;
+}
+template< typename T, typename Allocator >
+void LockFreeBucketStorage< T, Allocator >::recycle(Block *block) noexcept
+{
+	Block *top = spare.load(std::memory_order_relaxed);
+	do
+		block->fwd.store(top, std::memory_order_relaxed);
+	while (!spare.compare_exchange_weak(top, block, std::memory_order_release, std::memory_order_relaxed));
+}
+template< typename T, typename Allocator >
+typename LockFreeBucketStorage< T, Allocator >::Block *LockFreeBucketStorage< T, Allocator >::reserveBlock(Guard &guard)
+{
+	Block *block = hint.load(std::memory_order_acquire);
+	if (block != nullptr && block->reserve())
+		return block;
+	block = tail.load(std::memory_order_acquire);
+	if (block == nullptr)
+		block = head.load(std::memory_order_acquire);
+	if (block == nullptr)
+	{
+		Block *fresh = freshBlock();
+		if (head.compare_exchange_strong(block, fresh, std::memory_order_acq_rel, std::memory_order_acquire))
+			tail.store(block = fresh, std::memory_order_release);
+		else
+			guard.retire(fresh, 0, Stage::block);
+	}
+	for (;;)
+	{
+		if (block->reserve())
+		{
+			if (hint.load(std::memory_order_relaxed) != block)
+				hint.store(block, std::memory_order_release);
+			return block;
+		}
+		Block *next = block->fwd.load(std::memory_order_acquire);
+		if (marked(next))
+		{
+			block = head.load(std::memory_order_acquire);
+			continue;
+		}
+		if (next == nullptr)
+		{
+			Block *fresh = freshBlock();
+			fresh->live.store(1, std::memory_order_relaxed);
+			if (block->fwd.compare_exchange_strong(next, fresh, std::memory_order_acq_rel, std::memory_order_acquire))
+			{
+				tail.store(fresh, std::memory_order_release);
+				hint.store(fresh, std::memory_order_release);
+				return fresh;
+			}
+			guard.retire(fresh, 0, Stage::block);
+			if (marked(next))
+			{
+				block = head.load(std::memory_order_acquire);
+				continue;
+			}
+		}
+		block = next;
+	}
+}
+template< typename T, typename Allocator >
+bool LockFreeBucketStorage< T, Allocator >::unpublish(Guard &guard, Block *block, size_t slot)
+{
+	uint64_t bit = uint64_t(1) << (slot % Block::word_bits);
+	if ((block->published[slot / Block::word_bits].fetch_and(~bit, std::memory_order_acq_rel) & bit) == 0)
+		return false;
+	elements.fetch_sub(1, std::memory_order_relaxed);
+	guard.retire(block, slot, Stage::slot);
+	return true;
+}
+template< typename T, typename Allocator >
+void LockFreeBucketStorage< T, Allocator >::vacate(Guard &guard, Block *block, size_t slot)
+{
+	block->claimed[slot / Block::word_bits].fetch_and(~(uint64_t(1) << (slot % Block::word_bits)), std::memory_order_release);
+	if (block->live.fetch_sub(1, std::memory_order_acq_rel) == 1 && block->fwd.load(std::memory_order_acquire) != nullptr)
+	{
+		size_t expected = 0;
+		if (block->live.compare_exchange_strong(expected, Block::sealed, std::memory_order_acq_rel))
+		{
+			remove(guard, block);
+			return;
+		}
+	}
+	if (hint.load(std::memory_order_relaxed) != block)
+		hint.store(block, std::memory_order_release);
+}
+template< typename T, typename Allocator >
+void LockFreeBucketStorage< T, Allocator >::remove(Guard &guard, Block *block)
+{
+	Block *next = block->fwd.load(std::memory_order_acquire);
+	while (!block->fwd.compare_exchange_weak(next, mark(next), std::memory_order_acq_rel, std::memory_order_acquire))
+	{
+	}
+	while (!unlink(guard, block))
+	{
+	}
+}
+template< typename T, typename Allocator >
+bool LockFreeBucketStorage< T, Allocator >::unlink(Guard &guard, Block *target)
+{
+	std::atomic< Block * > *link = &head;
+	Block *current = link->load(std::memory_order_acquire);
+	while (current != nullptr)
+	{
+		if (marked(current))
+			return false;
+		Block *next = current->fwd.load(std::memory_order_acquire);
+		if (!marked(next))
+		{
+			link = &current->fwd;
+			current = next;
+			continue;
+		}
+		Block *expected = current;
+		if (!link->compare_exchange_strong(expected, strip(next), std::memory_order_acq_rel, std::memory_order_acquire))
+			return false;
+		guard.retire(current, 0, Stage::unlinked);
+		if (current == target)
+			return true;
+		current = strip(next);
+	}
+	return true;
+}
+template< typename T, typename Allocator >
+void LockFreeBucketStorage< T, Allocator >::reclaim(Guard &guard, const Retired &retired)
+{
+	Block *expected = retired.block;
+	switch (retired.stage)
+	{
+	case Stage::slot:
+		alloc_traits::destroy(alloc, retired.block->data + retired.slot);
+		vacate(guard, retired.block, retired.slot);
+		break;
+	case Stage::unlinked:
+		hint.compare_exchange_strong(expected, nullptr, std::memory_order_acq_rel);
+		expected = retired.block;
+		tail.compare_exchange_strong(expected, nullptr, std::memory_order_acq_rel);
+		guard.retire(retired.block, 0, Stage::block);
+		break;
+	case Stage::block:
+		recycle(retired.block);
+		break;
+	}
+}
+
+template< typename T, typename Allocator >
+LockFreeBucketStorage< T, Allocator >::Participant::Participant(const Allocator &alloc) :
+	local(0), in_use(true), next(nullptr), pins(0),
+	limbo{ Bag{ 0, retired_list(alloc) }, Bag{ 0, retired_list(alloc) }, Bag{ 0, retired_list(alloc) } }
+{
+}
+
+template< typename T, typename Allocator >
+LockFreeBucketStorage< T, Allocator >::Guard::Guard(LockFreeBucketStorage &storage) :
+	storage(storage), self(storage.acquire()), epoch(storage.epoch.load(std::memory_order_seq_cst))
+{
+	self->local.store(epoch << 1 | 1, std::memory_order_seq_cst);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (++self->pins % advance_period == 0)
+		storage.tryAdvance();
+	retired_list expired(storage.alloc);
+	for (Bag &bag : self->limbo)
+		if (!bag.items.empty() && bag.epoch + 2 <= epoch)
+		{
+			expired.insert(expired.end(), bag.items.begin(), bag.items.end());
+			bag.items.clear();
+		}
+	for (const Retired &retired : expired)
+		storage.reclaim(*this, retired);
+}
+template< typename T, typename Allocator >
+LockFreeBucketStorage< T, Allocator >::Guard::~Guard()
+{
+	self->local.store(epoch << 1, std::memory_order_release);
+	self->in_use.store(false, std::memory_order_release);
+}
+template< typename T, typename Allocator >
+void LockFreeBucketStorage< T, Allocator >::Guard::retire(Block *block, size_t slot, Stage stage)
+{
+	uint64_t current = storage.epoch.load(std::memory_order_seq_cst);
+	Bag &bag = self->limbo[current % 3];
+	bag.epoch = current;
+	bag.items.push_back(Retired{ block, slot, stage });
+}
+
+template< typename T, typename Allocator >
+typename LockFreeBucketStorage< T, Allocator >::Block *LockFreeBucketStorage< T, Allocator >::Block::create(size_t capacity, Allocator &alloc)
+{
+	using line_traits = typename alloc_traits::template rebind_traits< line >;
+	typename alloc_traits::template rebind_alloc< line > lines(alloc);
+	return new (std::to_address(line_traits::allocate(lines, units(capacity)))) Block(capacity);
+}
+template< typename T, typename Allocator >
+void LockFreeBucketStorage< T, Allocator >::Block::destroy(Block *block, Allocator &alloc) noexcept
+{
+	using line_traits = typename alloc_traits::template rebind_traits< line >;
+	typename alloc_traits::template rebind_alloc< line > lines(alloc);
+	size_t count = units(block->capacity);
+	if constexpr (!std::is_trivially_destructible_v< T >)
+		for (size_t i = block->seek(0); i < block->capacity; i = block->seek(i + 1))
+			alloc_traits::destroy(alloc, block->data + i);
+	block->~Block();
+	line_traits::deallocate(lines, std::pointer_traits< typename line_traits::pointer >::pointer_to(*reinterpret_cast< line * >(block)), count);
+}
+template< typename T, typename Allocator >
+constexpr size_t LockFreeBucketStorage< T, Allocator >::Block::dataOffset(size_t capacity) noexcept
+{
+	size_t header_end = sizeof(Block) + sizeof(std::atomic< uint64_t >) * (2 * ((capacity + word_bits - 1) / word_bits) + capacity);
+	return (header_end + alignof(line) - 1) / alignof(line) * alignof(line);
+}
+template< typename T, typename Allocator >
+constexpr size_t LockFreeBucketStorage< T, Allocator >::Block::units(size_t capacity) noexcept
+{
+	return (dataOffset(capacity) + sizeof(T) * capacity + sizeof(line) - 1) / sizeof(line);
+}
+template< typename T, typename Allocator >
+LockFreeBucketStorage< T, Allocator >::Block::Block(size_t capacity) noexcept :
+	capacity(capacity), data(reinterpret_cast< T * >(reinterpret_cast< char * >(this) + dataOffset(capacity))),
+	claimed(reinterpret_cast< std::atomic< uint64_t > * >(this + 1)), published(claimed + words()), stamps(published + words()),
+	live(0), fwd(nullptr)
+{
+	for (size_t w = 0; w < words(); w++)
+	{
+		new (claimed + w) std::atomic< uint64_t >(0);
+		new (published + w) std::atomic< uint64_t >(0);
+	}
+	for (size_t i = 0; i < capacity; i++)
+		new (stamps + i) std::atomic< uint64_t >(0);
+	if (capacity % word_bits != 0)
+		claimed[words() - 1].store(~uint64_t(0) << (capacity % word_bits), std::memory_order_relaxed);
+}
+template< typename T, typename Allocator >
+bool LockFreeBucketStorage< T, Allocator >::Block::reserve() noexcept
+{
+	size_t count = live.load(std::memory_order_relaxed);
+	while ((count & sealed) == 0 && count < capacity)
+		if (live.compare_exchange_weak(count, count + 1, std::memory_order_acquire, std::memory_order_relaxed))
+			return true;
+	return false;
+}
+template< typename T, typename Allocator >
+size_t LockFreeBucketStorage< T, Allocator >::Block::claim(size_t start) noexcept
+{
+	for (size_t w = start % words();; w = w + 1 == words() ? 0 : w + 1)
+	{
+		uint64_t bits = claimed[w].load(std::memory_order_relaxed);
+		while (bits != ~uint64_t(0))
+		{
+			uint64_t bit = ~bits & (bits + 1);
+			if (claimed[w].compare_exchange_weak(bits, bits | bit, std::memory_order_acquire, std::memory_order_relaxed))
+				return w * word_bits + std::countr_zero(bit);
+		}
+	}
+}
+template< typename T, typename Allocator >
+bool LockFreeBucketStorage< T, Allocator >::Block::isPublished(size_t i) const noexcept
+{
+	return (published[i / word_bits].load(std::memory_order_acquire) >> (i % word_bits) & 1) != 0;
+}
+template< typename T, typename Allocator >
+bool LockFreeBucketStorage< T, Allocator >::Block::holds(size_t i, uint64_t generation) const noexcept
+{
+	return i < capacity && isPublished(i) && stamps[i].load(std::memory_order_acquire) == generation;
+}
+template< typename T, typename Allocator >
+size_t LockFreeBucketStorage< T, Allocator >::Block::seek(size_t from) const noexcept
+{
+	if (from >= capacity)
+		return capacity;
+	size_t w = from / word_bits;
+	uint64_t bits = published[w].load(std::memory_order_acquire) & (~uint64_t(0) << (from % word_bits));
+	while (bits == 0)
+	{
+		if (++w == words())
+			return capacity;
+		bits = published[w].load(std::memory_order_acquire);
+	}
+	return w * word_bits + std::countr_zero(bits);
+}
+template< typename T, typename Allocator >
+size_t LockFreeBucketStorage< T, Allocator >::Block::words() const noexcept
+{
+	return (capacity + word_bits - 1) / word_bits;
+}
+
+template< typename T, typename Allocator >
+LockFreeBucketStorage< T, Allocator >::iterator::iterator(Block *block, size_t slot) : block(block), slot(slot)
+{
+	settle();
+}
+template< typename T, typename Allocator >
+void LockFreeBucketStorage< T, Allocator >::iterator::settle()
+{
+	while (block != nullptr)
+	{
+		slot = block->seek(slot);
+		if (slot < block->capacity)
+			return;
+		block = strip(block->fwd.load(std::memory_order_acquire));
+		slot = 0;
+	}
+	slot = 0;
+}
+template< typename T, typename Allocator >
+typename LockFreeBucketStorage< T, Allocator >::iterator &LockFreeBucketStorage< T, Allocator >::iterator::operator++()
+{
+	slot++;
+	settle();
+	return *this;
+}
+template< typename T, typename Allocator >
+typename LockFreeBucketStorage< T, Allocator >::iterator LockFreeBucketStorage< T, Allocator >::iterator::operator++(int)
+{
+	iterator old = *this;
+	++*this;
+	return old;
+}
+template< typename T, typename Allocator >
+typename LockFreeBucketStorage< T, Allocator >::iterator::reference LockFreeBucketStorage< T, Allocator >::iterator::operator*() const
+{
+	return block->data[slot];
+}
+template< typename T, typename Allocator >
+typename LockFreeBucketStorage< T, Allocator >::iterator::pointer LockFreeBucketStorage< T, Allocator >::iterator::operator->() const
+{
+	return block->data + slot;
+}
+template< typename T, typename Allocator >
+bool LockFreeBucketStorage< T, Allocator >::iterator::operator==(const iterator &a) const
+{
+	return block == a.block && slot == a.slot;
+}
+
+template< typename T, typename Allocator >
+LockFreeBucketStorage< T, Allocator >::range::range(LockFreeBucketStorage &storage) :
+	guard(storage), head(storage.head.load(std::memory_order_acquire))
+{
+}
+template< typename T, typename Allocator >
+typename LockFreeBucketStorage< T, Allocator >::iterator LockFreeBucketStorage< T, Allocator >::range::begin() const
+{
+	return iterator(head, 0);
+}
+template< typename T, typename Allocator >
+typename LockFreeBucketStorage< T, Allocator >::iterator LockFreeBucketStorage< T, Allocator >::range::end() const
+{
+	return iterator();
+}
+
+#endif
@@ -0,0 +1,675 @@
+#ifndef PERSISTENT_BUCKET_STORAGE
+#define PERSISTENT_BUCKET_STORAGE
+
+#if __has_include(<sys/mman.h>)
+
+#include <bit>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <new>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+template< typename T >
+class PersistentBucketStorage
+{
+	static_assert(std::is_trivially_copyable_v< T >);
+
+  public:
+	using value_type = T;
+	using pointer = T *;
+	using const_pointer = const T *;
+	using reference = T &;
+	using const_reference = const T &;
+	using difference_type = long;
+	using size_type = size_t;
+	template< typename V >
+	class basic_iterator;
+	using iterator = basic_iterator< T >;
+	using const_iterator = basic_iterator< const T >;
+	static constexpr size_t default_capacity = 64;
+
+  public:
+	explicit PersistentBucketStorage(const char *path, size_t block_capacity = default_capacity);
+	PersistentBucketStorage(const PersistentBucketStorage &other) = delete;
+	PersistentBucketStorage &operator=(const PersistentBucketStorage &other) = delete;
+	~PersistentBucketStorage();
+
+	iterator insert(const T &value);
+	template< typename... Args >
+	iterator emplace(Args &&...args);
+	iterator erase(const_iterator it);
+	void clear();
+	void checkpoint();
+
+	bool empty() const noexcept;
+	size_t size() const noexcept;
+	size_t capacity() const noexcept;
+	size_t block_capacity() const noexcept;
+
+	iterator begin() noexcept;
+	const_iterator begin() const noexcept;
+	const_iterator cbegin() const noexcept;
+	iterator end() noexcept;
+	const_iterator end() const noexcept;
+	const_iterator cend() const noexcept;
+
+  private:
+	struct Header
+	{
+		char magic[8];
+		uint64_t version;
+		uint64_t value_size;
+		uint64_t value_alignment;
+		uint64_t block_capacity;
+		uint64_t end;
+		uint64_t head;
+		uint64_t tail;
+		uint64_t vacant;
+		uint64_t pool;
+		uint64_t blocks;
+		uint64_t elements;
+		uint64_t clean;
+	};
+
+	struct Block
+	{
+		uint64_t fwd;
+		uint64_t bwd;
+		uint64_t prev_vacant;
+		uint64_t next_vacant;
+		uint64_t size;
+		uint64_t vacant;
+	};
+
+	static constexpr char header_magic[8] = { 'B', 'K', 'T', 'P', 'E', 'R', 'S', 'T' };
+	static constexpr uint64_t header_version = 1;
+	static constexpr size_t page = 4096;
+	static constexpr size_t word_bits = 64;
+	static constexpr size_t alignment = alignof(T) > 64 ? alignof(T) : 64;
+	static constexpr size_t align(size_t offset, size_t to) noexcept;
+
+	Header *header() const noexcept;
+	Block *block(uint64_t offset) const noexcept;
+	uint64_t *occupied(uint64_t offset) const noexcept;
+	T *data(uint64_t offset) const noexcept;
+	size_t words() const noexcept;
+	uint64_t first() const noexcept;
+	size_t seek(uint64_t offset, size_t from) const noexcept;
+	size_t seekBack(uint64_t offset, size_t before) const noexcept;
+
+	void layout(size_t block_capacity) noexcept;
+	void initialize(size_t block_capacity);
+	void validate(const char *path) const;
+	void recover();
+	void markDirty();
+	void remap(uint64_t new_length);
+	bool full() const noexcept;
+	uint64_t acquireBlock();
+	void releaseBlock(uint64_t offset) noexcept;
+	void pushVacant(uint64_t offset) noexcept;
+	void popVacant(uint64_t offset) noexcept;
+	template< typename... Args >
+	iterator place(Args &&...args);
+
+	int fd;
+	unsigned char *base;
+	uint64_t length;
+	size_t capacity_per_block;
+	size_t data_offset;
+	size_t block_bytes;
+
+  public:
+	template< typename V >
+	class basic_iterator
+	{
+	  public:
+		using iterator_category = std::bidirectional_iterator_tag;
+		using value_type = T;
+		using pointer = V *;
+		using reference = V &;
+		using difference_type = long;
+
+		basic_iterator() = default;
+		template< typename U >
+			requires(std::is_const_v< V > && !std::is_const_v< U >)
+		basic_iterator(const basic_iterator< U > &other);
+
+		basic_iterator &operator++();
+		basic_iterator operator++(int);
+		basic_iterator &operator--();
+		basic_iterator operator--(int);
+
+		reference operator*() const;
+		pointer operator->() const;
+
+		template< typename U >
+		bool operator==(const basic_iterator< U > &a) const;
+
+	  private:
+		friend PersistentBucketStorage;
+		template< typename U >
+		friend class basic_iterator;
+		basic_iterator(const PersistentBucketStorage *storage, uint64_t offset, size_t slot);
+		const PersistentBucketStorage *storage = nullptr;
+		uint64_t offset = 0;
+		size_t slot = 0;
+	};
+};
+
+template< typename T >
+PersistentBucketStorage< T >::PersistentBucketStorage(const char *path, size_t block_capacity) :
+	fd(open(path, O_RDWR | O_CREAT, 0644)), base(nullptr), length(0)
+{
+	if (fd < 0)
+		throw std::system_error(errno, std::generic_category(), path);
+	try
+	{
+		struct stat info;
+		if (fstat(fd, &info) != 0)
+			throw std::system_error(errno, std::generic_category(), path);
+		if (info.st_size == 0)
+		{
+			layout(block_capacity == 0 ? default_capacity : block_capacity);
+			remap(align(first() + block_bytes, page));
+			initialize(capacity_per_block);
+		}
+		else
+		{
+			if (static_cast< size_t >(info.st_size) < sizeof(Header))
+				throw std::system_error(std::make_error_code(std::errc::invalid_argument), path);
+			base = static_cast< unsigned char * >(mmap(nullptr, info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
+			if (base == MAP_FAILED)
+			{
+				base = nullptr;
+				throw std::system_error(errno, std::generic_category(), path);
+			}
+			length = info.st_size;
+			validate(path);
+			layout(header()->block_capacity);
+			if (header()->clean == 0)
+				recover();
+		}
+		markDirty();
+	} catch (...)
+	{
+		if (base != nullptr)
+			munmap(base, length);
+		close(fd);
+		throw;
+	}
+}
+
+template< typename T >
+PersistentBucketStorage< T >::~PersistentBucketStorage()
+{
+	header()->clean = 1;
+	msync(base, length, MS_SYNC);
+	munmap(base, length);
+	close(fd);
+}
+
+template< typename T >
+typename PersistentBucketStorage< T >::iterator PersistentBucketStorage< T >::insert(const T &value)
+{
+	return emplace(value);
+}
+template< typename T >
+template< typename... Args >
+typename PersistentBucketStorage< T >::iterator PersistentBucketStorage< T >::emplace(Args &&...args)
+{
+	if (!full())
+		return place(std::forward< Args >(args)...);
+	T value(std::forward< Args >(args)...);
+	return place(value);
+}
+template< typename T >
+template< typename... Args >
+typename PersistentBucketStorage< T >::iterator PersistentBucketStorage< T >::place(Args &&...args)
+{
+	uint64_t offset = header()->vacant;
+	if (offset == 0)
+	{
+		offset = acquireBlock();
+		pushVacant(offset);
+	}
+	uint64_t *bits = occupied(offset);
+	size_t w = 0;
+	while (bits[w] == ~uint64_t(0))
+		w++;
+	size_t slot = w * word_bits + std::countr_one(bits[w]);
+	new (data(offset) + slot) T(std::forward< Args >(args)...);
+	bits[w] |= uint64_t(1) << (slot % word_bits);
+	Block *target = block(offset);
+	if (++target->size == capacity_per_block)
+		popVacant(offset);
+	header()->elements++;
+	return iterator(this, offset, slot);
+}
+template< typename T >
+typename PersistentBucketStorage< T >::iterator PersistentBucketStorage< T >::erase(const_iterator it)
+{
+	iterator next(this, it.offset, it.slot);
+	++next;
+	Block *target = block(it.offset);
+	occupied(it.offset)[it.slot / word_bits] &= ~(uint64_t(1) << (it.slot % word_bits));
+	header()->elements--;
+	if (target->size-- == capacity_per_block)
+		pushVacant(it.offset);
+	if (target->size == 0 && header()->blocks > 1)
+		releaseBlock(it.offset);
+	return next;
+}
+template< typename T >
+void PersistentBucketStorage< T >::clear()
+{
+	while (header()->head != 0 && block(header()->head)->fwd != 0)
+		releaseBlock(header()->head);
+	if (header()->head != 0)
+	{
+		std::memset(occupied(header()->head), 0, sizeof(uint64_t) * words());
+		block(header()->head)->size = 0;
+		pushVacant(header()->head);
+	}
+	header()->elements = 0;
+}
+template< typename T >
+void PersistentBucketStorage< T >::checkpoint()
+{
+	header()->clean = 1;
+	if (msync(base, length, MS_SYNC) != 0)
+	{
+		int error = errno;
+		header()->clean = 0;
+		throw std::system_error(error, std::generic_category(), "msync");
+	}
+	markDirty();
+}
+
+template< typename T >
+bool PersistentBucketStorage< T >::empty() const noexcept
+{
+	return size() == 0;
+}
+template< typename T >
+size_t PersistentBucketStorage< T >::size() const noexcept
+{
+	return header()->elements;
+}
+template< typename T >
+size_t PersistentBucketStorage< T >::capacity() const noexcept
+{
+	return header()->blocks * capacity_per_block;
+}
+template< typename T >
+size_t PersistentBucketStorage< T >::block_capacity() const noexcept
+{
+	return capacity_per_block;
+}
+
+template< typename T >
+typename PersistentBucketStorage< T >::iterator PersistentBucketStorage< T >::begin() noexcept
+{
+	return iterator(this, header()->head, 0);
+}
+template< typename T >
+typename PersistentBucketStorage< T >::const_iterator PersistentBucketStorage< T >::begin() const noexcept
+{
+	return const_iterator(this, header()->head, 0);
+}
+template< typename T >
+typename PersistentBucketStorage< T >::const_iterator PersistentBucketStorage< T >::cbegin() const noexcept
+{
+	return begin();
+}
+template< typename T >
+typename PersistentBucketStorage< T >::iterator PersistentBucketStorage< T >::end() noexcept
+{
+	return iterator(this, 0, 0);
+}
+template< typename T >
+typename PersistentBucketStorage< T >::const_iterator PersistentBucketStorage< T >::end() const noexcept
+{
+	return const_iterator(this, 0, 0);
+}
+template< typename T >
+typename PersistentBucketStorage< T >::const_iterator PersistentBucketStorage< T >::cend() const noexcept
+{
+	return end();
+}
+
+template< typename T >
+constexpr size_t PersistentBucketStorage< T >::align(size_t offset, size_t to) noexcept
+{
+	return (offset + to - 1) / to * to;
+}
+template< typename T >
+typename PersistentBucketStorage< T >::Header *PersistentBucketStorage< T >::header() const noexcept
+{
+	return reinterpret_cast< Header * >(base);
+}
+template< typename T >
+typename PersistentBucketStorage< T >::Block *PersistentBucketStorage< T >::block(uint64_t offset) const noexcept
+{
+	return reinterpret_cast< Block * >(base + offset);
+}
+template< typename T >
+uint64_t *PersistentBucketStorage< T >::occupied(uint64_t offset) const noexcept
+{
+	return reinterpret_cast< uint64_t * >(base + offset + sizeof(Block));
+}
+template< typename T >
+T *PersistentBucketStorage< T >::data(uint64_t offset) const noexcept
+{
+	return reinterpret_cast< T * >(base + offset + data_offset);
+}
+template< typename T >
+size_t PersistentBucketStorage< T >::words() const noexcept
+{
+	return (capacity_per_block + word_bits - 1) / word_bits;
+}
+template< typename T >
+uint64_t PersistentBucketStorage< T >::first() const noexcept
+{
+	return align(sizeof(Header), page);
+}
+template< typename T >
+size_t PersistentBucketStorage< T >::seek(uint64_t offset, size_t from) const noexcept
+{
+	if (from >= capacity_per_block)
+		return capacity_per_block;
+	const uint64_t *bits = occupied(offset);
+	size_t w = from / word_bits;
+	uint64_t word = bits[w] & (~uint64_t(0) << (from % word_bits));
+	while (word == 0)
+	{
+		if (++w == words())
+			return capacity_per_block;
+		word = bits[w];
+	}
+	return w * word_bits + std::countr_zero(word);
+}
+template< typename T >
+size_t PersistentBucketStorage< T >::seekBack(uint64_t offset, size_t before) const noexcept
+{
+	const uint64_t *bits = occupied(offset);
+	size_t w = before / word_bits;
+	uint64_t word = before % word_bits == 0 ? 0 : bits[w] & ((uint64_t(1) << (before % word_bits)) - 1);
+	while (word == 0)
+	{
+		if (w-- == 0)
+			return capacity_per_block;
+		word = bits[w];
+	}
+	return w * word_bits + word_bits - 1 - std::countl_zero(word);
+}
+
+template< typename T >
+void PersistentBucketStorage< T >::layout(size_t block_capacity) noexcept
+{
+	capacity_per_block = block_capacity;
+	data_offset = align(sizeof(Block) + sizeof(uint64_t) * words(), alignment);
+	block_bytes = align(data_offset + sizeof(T) * capacity_per_block, alignment);
+}
+template< typename T >
+void PersistentBucketStorage< T >::initialize(size_t block_capacity)
+{
+	Header *target = header();
+	std::memset(target, 0, sizeof(Header));
+	std::memcpy(target->magic, header_magic, sizeof(target->magic));
+	target->version = header_version;
+	target->value_size = sizeof(T);
+	target->value_alignment = alignof(T);
+	target->block_capacity = block_capacity;
+	target->end = first();
+}
+template< typename T >
+void PersistentBucketStorage< T >::validate(const char *path) const
+{
+	const Header *target = header();
+	bool valid = std::memcmp(target->magic, header_magic, sizeof(target->magic)) == 0 &&
+				 target->version == header_version && target->value_size == sizeof(T) &&
+				 target->value_alignment == alignof(T) && target->block_capacity != 0 && target->end <= length &&
+				 target->end >= align(sizeof(Header), page);
+	if (!valid)
+		throw std::system_error(std::make_error_code(std::errc::invalid_argument), path);
+}
+template< typename T >
+void PersistentBucketStorage< T >::markDirty()
+{
+	header()->clean = 0;
+	if (msync(base, first(), MS_SYNC) != 0)
+		throw std::system_error(errno, std::generic_category(), "msync");
+}
+template< typename T >
+void PersistentBucketStorage< T >::recover()
+{
+	Header *target = header();
+	size_t count = (target->end - first()) / block_bytes;
+	target->end = first() + count * block_bytes;
+	std::vector< bool > linked(count);
+	target->tail = 0;
+	target->vacant = 0;
+	target->pool = 0;
+	target->blocks = 0;
+	target->elements = 0;
+	uint64_t *link = &target->head;
+	while (*link != 0)
+	{
+		uint64_t offset = *link;
+		if (offset < first() || offset >= target->end || (offset - first()) % block_bytes != 0 ||
+			linked[(offset - first()) / block_bytes])
+		{
+			*link = 0;
+			break;
+		}
+		linked[(offset - first()) / block_bytes] = true;
+		Block *current = block(offset);
+		current->bwd = target->tail;
+		current->size = 0;
+		current->vacant = 0;
+		for (size_t w = 0; w < words(); w++)
+			current->size += std::popcount(occupied(offset)[w]);
+		target->tail = offset;
+		target->blocks++;
+		target->elements += current->size;
+		if (current->size != capacity_per_block)
+			pushVacant(offset);
+		link = &current->fwd;
+	}
+	for (size_t index = count; index-- > 0;)
+		if (!linked[index])
+		{
+			uint64_t offset = first() + index * block_bytes;
+			block(offset)->fwd = target->pool;
+			target->pool = offset;
+		}
+}
+template< typename T >
+void PersistentBucketStorage< T >::remap(uint64_t new_length)
+{
+	if (ftruncate(fd, static_cast< off_t >(new_length)) != 0)
+		throw std::system_error(errno, std::generic_category(), "ftruncate");
+	void *mapped = mmap(nullptr, new_length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (mapped == MAP_FAILED)
+		throw std::system_error(errno, std::generic_category(), "mmap");
+	if (base != nullptr)
+		munmap(base, length);
+	base = static_cast< unsigned char * >(mapped);
+	length = new_length;
+}
+template< typename T >
+bool PersistentBucketStorage< T >::full() const noexcept
+{
+	return header()->vacant == 0 && header()->pool == 0 && header()->end + block_bytes > length;
+}
+template< typename T >
+uint64_t PersistentBucketStorage< T >::acquireBlock()
+{
+	uint64_t offset = header()->pool;
+	if (offset != 0)
+		header()->pool = block(offset)->fwd;
+	else
+	{
+		if (header()->end + block_bytes > length)
+			remap(align(std::max(2 * length, header()->end + block_bytes), page));
+		offset = header()->end;
+		header()->end += block_bytes;
+	}
+	Block *fresh = block(offset);
+	std::memset(fresh, 0, sizeof(Block) + sizeof(uint64_t) * words());
+	fresh->bwd = header()->tail;
+	if (header()->tail == 0)
+		header()->head = offset;
+	else
+		block(header()->tail)->fwd = offset;
+	header()->tail = offset;
+	header()->blocks++;
+	return offset;
+}
+template< typename T >
+void PersistentBucketStorage< T >::releaseBlock(uint64_t offset) noexcept
+{
+	Block *target = block(offset);
+	popVacant(offset);
+	if (target->bwd != 0)
+		block(target->bwd)->fwd = target->fwd;
+	else
+		header()->head = target->fwd;
+	if (target->fwd != 0)
+		block(target->fwd)->bwd = target->bwd;
+	else
+		header()->tail = target->bwd;
+	header()->blocks--;
+	header()->elements -= target->size;
+	target->bwd = 0;
+	target->fwd = header()->pool;
+	header()->pool = offset;
+}
+template< typename T >
+void PersistentBucketStorage< T >::pushVacant(uint64_t offset) noexcept
+{
+	Block *target = block(offset);
+	if (target->vacant != 0)
+		return;
+	target->vacant = 1;
+	target->prev_vacant = 0;
+	target->next_vacant = header()->vacant;
+	if (header()->vacant != 0)
+		block(header()->vacant)->prev_vacant = offset;
+	header()->vacant = offset;
+}
+template< typename T >
+void PersistentBucketStorage< T >::popVacant(uint64_t offset) noexcept
+{
+	Block *target = block(offset);
+	if (target->vacant == 0)
+		return;
+	target->vacant = 0;
+	if (target->prev_vacant != 0)
+		block(target->prev_vacant)->next_vacant = target->next_vacant;
+	else
+		header()->vacant = target->next_vacant;
+	if (target->next_vacant != 0)
+		block(target->next_vacant)->prev_vacant = target->prev_vacant;
+}
+
+template< typename T >
+template< typename V >
+PersistentBucketStorage< T >::basic_iterator< V >::basic_iterator(const PersistentBucketStorage *storage, uint64_t offset, size_t slot) :
+	storage(storage), offset(offset), slot(slot)
+{
+	while (this->offset != 0)
+	{
+		this->slot = storage->seek(this->offset, this->slot);
+		if (this->slot != storage->capacity_per_block)
+			return;
+		this->offset = storage->block(this->offset)->fwd;
+		this->slot = 0;
+	}
+	this->slot = 0;
+}
+template< typename T >
+template< typename V >
+template< typename U >
+	requires(std::is_const_v< V > && !std::is_const_v< U >)
+PersistentBucketStorage< T >::basic_iterator< V >::basic_iterator(const basic_iterator< U > &other) :
+	storage(other.storage), offset(other.offset), slot(other.slot)
+{
+}
+template< typename T >
+template< typename V >
+typename PersistentBucketStorage< T >::template basic_iterator< V > &PersistentBucketStorage< T >::basic_iterator< V >::operator++()
+{
+	*this = basic_iterator(storage, offset, slot + 1);
+	return *this;
+}
+template< typename T >
+template< typename V >
+typename PersistentBucketStorage< T >::template basic_iterator< V > PersistentBucketStorage< T >::basic_iterator< V >::operator++(int)
+{
+	basic_iterator old = *this;
+	++*this;
+	return old;
+}
+template< typename T >
+template< typename V >
+typename PersistentBucketStorage< T >::template basic_iterator< V > &PersistentBucketStorage< T >::basic_iterator< V >::operator--()
+{
+	if (offset == 0)
+	{
+		offset = storage->header()->tail;
+		slot = storage->capacity_per_block;
+	}
+	for (;;)
+	{
+		size_t found = storage->seekBack(offset, slot);
+		if (found != storage->capacity_per_block)
+		{
+			slot = found;
+			return *this;
+		}
+		offset = storage->block(offset)->bwd;
+		slot = storage->capacity_per_block;
+	}
+}
+template< typename T >
+template< typename V >
+typename PersistentBucketStorage< T >::template basic_iterator< V > PersistentBucketStorage< T >::basic_iterator< V >::operator--(int)
+{
+	basic_iterator old = *this;
+	--*this;
+	return old;
+}
+template< typename T >
+template< typename V >
+typename PersistentBucketStorage< T >::template basic_iterator< V >::reference PersistentBucketStorage< T >::basic_iterator< V >::operator*() const
+{
+	return storage->data(offset)[slot];
+}
+template< typename T >
+template< typename V >
+typename PersistentBucketStorage< T >::template basic_iterator< V >::pointer PersistentBucketStorage< T >::basic_iterator< V >::operator->() const
+{
+	return storage->data(offset) + slot;
+}
+template< typename T >
+template< typename V >
+template< typename U >
+bool PersistentBucketStorage< T >::basic_iterator< V >::operator==(const basic_iterator< U > &a) const
+{
+	return offset == a.offset && slot == a.slot;
+}
+
+#endif
+
+#endif